@@ -3,350 +3,1990 @@
  * Author: Stanislav Serbezov
  *
  * A. Setup
- * a1. Read number of students from command line
+ * a1. Read number of students (and TAs, chairs) from command line
  * a2. Initialize shared variables
- * a3. Initialize mutex and semaphores
+ * a3. Initialize semaphores
  * a4. Allocate arrays for threads, ids, semaphores
  *
  * B. Create threads
- * b1. Create 1 TA thread
+ * b1. Create the TA threads (1 by default)
  * b2. Create n student threads
  * b3. Give each student a unique id
  *
  * C. Runtime logic
  * c1. Student programs for random time
- * c2. Student asks TA for help
- * c3. If chair available, student waits
+ * c2. Student asks a TA for help
+ * c3. If chair available, student waits in the queue of their TA
  * c4. If no chair, student comes back later
- * c5. If TA is sleeping, student wakes TA
- * c6. TA helps one student at a time
+ * c5. If a TA is sleeping, student wakes that TA
+ * c6. Each TA helps one student at a time
  * c7. TA sleeps again if nobody is waiting
+ * c8. An idle TA takes a waiting student from another TA's queue
  *
  * D. Sync
- * d1. Mutex protects shared data
- * d2. students_waiting wakes TA
- * d3. student_called[i] calls one student
- * d4. student_done[i] tells student help is done
+ * d1. Atomics protect shared data (the waiting room takes no lock)
+ * d2. tas[t].wake wakes one TA
+ * d3. student_state[i] = STUDENT_CALLED calls one student
+ * d4. student_state[i] = STUDENT_DONE tells student help is done
  *
  * Compile: gcc -pthread A2.c -o A2
  * Run: ./A2 5
+ *      ./A2 -t 4 -c 8 1000
+ *      ./A2 -b -c 64 1000
+ *      ./A2 -w 256
+ *      ./A2 -h 1000
+ *      ./A2 -v 100000 -t 4 -c 8 1000
  */
 
+#define _GNU_SOURCE                    /* RUSAGE_THREAD */
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include <unistd.h>
 #include <pthread.h>
 #include <semaphore.h>
+#include <sched.h>
 #include <stdarg.h>
+#include <stdatomic.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 
 #define CHAIRS 3
+#define MAX_TAS 64
+
+/* -b: seconds per TA count, and program/help "seconds" become milliseconds */
+#define BENCH_SECONDS 2
+#define BENCH_TIME_UNIT 1000
+
+/* -w: seconds per number of students and waiting room; -e: a turned-away student yields, then sleeps */
+#define ROOM_BENCH_SECONDS 1
+#define ROOM_BACKOFF_YIELDS 4
+#define ROOM_BACKOFF_MAX_US 100000
+
+/* -e: a student turned away again programs twice as long each time, up to 2^BACKOFF_MAX times */
+#define BACKOFF_MAX 10
+
+/* handoffs spin this many times before sleeping (on more than one CPU); -h keeps this many latencies */
+#define HANDOFF_SPINS 1000
+#define HANDOFF_SAMPLES (1 << 20)
+
+/*
+ * d2-d4. Handoffs without semaphores. A handoff word moves in steps of
+ * 2; its low bit says a thread sleeps on it. The waiting thread spins
+ * a little, then sets the bit and sleeps in the kernel (futex) until
+ * the value changes. The other side only makes a system call when the
+ * bit is set, so a handoff to a thread that is still spinning costs
+ * one atomic instruction.
+ */
+#define PARKED 1u
+
+/* on one CPU the thread to wait for cannot run while we spin */
+int handoff_spins = HANDOFF_SPINS;
+
+/* timeout == NULL: no time limit */
+static void futex_wait(atomic_uint *word, unsigned value, const struct timespec *timeout) {
+    syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, value, timeout, NULL, 0);
+}
+
+static void futex_wake(atomic_uint *word) {
+    syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+static void cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+/* returns once *word (without the low bit) is no longer value */
+static void handoff_wait(atomic_uint *word, unsigned value) {
+    unsigned now;
+    int spins;
+
+    for (spins = 0; spins < handoff_spins; spins++) {
+        if ((atomic_load_explicit(word, memory_order_acquire) & ~PARKED) != value) {
+            return;
+        }
+        cpu_relax();
+    }
+
+    while (((now = atomic_load_explicit(word, memory_order_acquire)) & ~PARKED) == value) {
+        if (now == value && !atomic_compare_exchange_weak(word, &now, value | PARKED)) {
+            continue;
+        }
+        futex_wait(word, value | PARKED, NULL);
+    }
+}
+
+/* sets a state word, waking its thread if it sleeps */
+static void handoff_set(atomic_uint *word, unsigned value) {
+    if (atomic_exchange_explicit(word, value, memory_order_release) & PARKED) {
+        futex_wake(word);
+    }
+}
+
+/* moves a counter on (an eventcount), waking its thread if it sleeps */
+static void handoff_bump(atomic_uint *word) {
+    if (atomic_fetch_add(word, 2) & PARKED) {
+        atomic_fetch_and(word, ~PARKED);
+        futex_wake(word);
+    }
+}
+
+/*
+ * Logging. printf() is log_printf(): every message goes to the terminal
+ * and to logs/ta_output.log, where it also carries the time and the
+ * thread that printed it. Threads never wait for each other or for the
+ * disk to log: each thread that logs gets a small ring on its first
+ * message and appends to it, and a flusher thread collects the rings
+ * every LOG_FLUSH_MS (or sooner when a ring fills up) and writes them
+ * with one write() per sink. Every message takes the next number of
+ * log_seq, so if one message was printed before another, it has the
+ * lower number; the flusher writes messages in that order, and only up
+ * to the first number still being written. A thread whose ring is full
+ * wakes the flusher and yields a few times; if there is still no room,
+ * the message is dropped and counted, and the log says how many were
+ * lost.
+ */
+#define LOG_RING_SIZE (4 * 1024)       /* bytes per thread that logs */
+#define LOG_LINE 512                   /* longest message */
+#define LOG_BATCH (1024 * 1024)        /* bytes collected per write */
+#define LOG_BATCH_RECORDS 16384        /* messages collected per write */
+#define LOG_PREFIX 48                  /* "[seconds.microseconds tid] " */
+#define LOG_FLUSH_MS 10
+#define LOG_FULL_TRIES 100
 
 FILE *log_fp = NULL;
-pthread_mutex_t log_mutex;
+int log_quiet = 0;
+
+/* a message in a ring: this header, then len bytes of text */
+struct log_record {
+    unsigned long seq;
+    long long ns;
+    int tid;
+    int len;
+};
+
+/* one thread's messages; only that thread appends and only the flusher takes */
+struct log_ring {
+    struct log_ring *next;                 /* all rings ever made */
+    atomic_int in_use;                     /* a live thread owns it */
+    int tid;
+    char data[LOG_RING_SIZE];
+    _Alignas(64) atomic_ulong busy;        /* 1 + at most the seq being written, or 0 */
+    atomic_size_t tail;                    /* bytes appended */
+    _Alignas(64) atomic_size_t head;       /* bytes taken */
+};
+
+
+_Atomic(struct log_ring *) log_rings = NULL;
+_Thread_local struct log_ring *log_mine = NULL;
+pthread_key_t log_key;
+atomic_uint log_wake = 0;              /* eventcount the flusher sleeps on */
+atomic_int log_stop = 0;
+atomic_long log_dropped = 0;
+atomic_ulong log_seq = 0;              /* number of the next message */
+long long log_start_ns = 0;
+pthread_t log_tid;
+
+/* the flusher's batch: collected text, where each message sits, and what goes to each sink */
+struct log_entry {
+    long long ns;
+    int tid;
+    int len;
+    size_t at;
+};
+
+/* the flusher's place in one ring and the message there, kept in a heap by seq */
+struct log_cursor {
+    struct log_ring *ring;
+    size_t head;
+    size_t tail;
+    struct log_record rec;
+};
+
+char *log_batch = NULL;
+struct log_entry *log_entries = NULL;
+struct log_cursor *log_cursors = NULL;
+int log_cursor_room = 0;
+char *log_out_term = NULL;
+char *log_out_file = NULL;
+
+static long long log_now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* a thread's ring goes back to the pool when it exits; the flusher still empties it */
+static void log_release(void *ring) {
+    atomic_store(&((struct log_ring *)ring)->in_use, 0);
+}
+
+/* the calling thread's ring, reusing one of a finished thread if there is one */
+static struct log_ring *log_ring_of_thread(void) {
+    struct log_ring *ring;
+
+    for (ring = atomic_load(&log_rings); ring != NULL; ring = ring->next) {
+        int expected = 0;
+
+        if (atomic_compare_exchange_strong(&ring->in_use, &expected, 1)) {
+            break;
+        }
+    }
+
+    if (ring == NULL) {
+        ring = aligned_alloc(64, sizeof(struct log_ring));
+        if (ring == NULL) {
+            return NULL;
+        }
+        atomic_init(&ring->in_use, 1);
+        atomic_init(&ring->busy, 0);
+        atomic_init(&ring->tail, 0);
+        atomic_init(&ring->head, 0);
+        ring->next = atomic_load(&log_rings);
+        while (!atomic_compare_exchange_weak(&log_rings, &ring->next, ring)) {
+        }
+    }
+
+    ring->tid = (int)syscall(SYS_gettid);
+    pthread_setspecific(log_key, ring);
+    return ring;
+}
+
+static void ring_copy_in(struct log_ring *ring, size_t pos, const void *src, size_t len) {
+    size_t at = pos % LOG_RING_SIZE;
+    size_t first = len < LOG_RING_SIZE - at ? len : LOG_RING_SIZE - at;
+
+    memcpy(ring->data + at, src, first);
+    memcpy(ring->data, (const char *)src + first, len - first);
+}
+
+static void ring_copy_out(const struct log_ring *ring, size_t pos, void *dst, size_t len) {
+    size_t at = pos % LOG_RING_SIZE;
+    size_t first = len < LOG_RING_SIZE - at ? len : LOG_RING_SIZE - at;
+
+    memcpy(dst, ring->data + at, first);
+    memcpy((char *)dst + first, ring->data, len - first);
+}
 
 void log_printf(const char *fmt, ...) {
+    struct log_ring *ring = log_mine;
+    struct log_record rec;
+    char text[LOG_LINE];
     va_list args;
+    size_t tail;
+    size_t need;
+    int tries;
+
+    if (log_quiet) {
+        return;
+    }
+
+    if (ring == NULL) {
+        ring = log_mine = log_ring_of_thread();
+        if (ring == NULL) {
+            atomic_fetch_add(&log_dropped, 1);
+            return;
+        }
+    }
+
+    va_start(args, fmt);
+    rec.len = vsnprintf(text, sizeof(text), fmt, args);
+    va_end(args);
+    if (rec.len < 0) {
+        return;
+    }
+    if (rec.len >= LOG_LINE) {
+        rec.len = LOG_LINE - 1;
+    }
+    rec.tid = ring->tid;
+    need = sizeof(rec) + rec.len;
+
+    tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    for (tries = 0; LOG_RING_SIZE - (tail - atomic_load_explicit(&ring->head, memory_order_acquire)) < need;
+         tries++) {
+        if (tries == LOG_FULL_TRIES) {
+            atomic_fetch_add(&log_dropped, 1);
+            return;
+        }
+        handoff_bump(&log_wake);
+        sched_yield();
+    }
+
+    /* say which numbers may be in flight before taking one, so the flusher never passes it */
+    atomic_store(&ring->busy, atomic_load(&log_seq) + 1);
+    rec.seq = atomic_fetch_add(&log_seq, 1);
+    rec.ns = log_now_ns();
+    ring_copy_in(ring, tail, &rec, sizeof(rec));
+    ring_copy_in(ring, tail + sizeof(rec), text, rec.len);
+    atomic_store_explicit(&ring->tail, tail + need, memory_order_release);
+    atomic_store(&ring->busy, 0);
+
+    /* half full: do not wait for the next tick */
+    if (tail + need - atomic_load_explicit(&ring->head, memory_order_relaxed) > LOG_RING_SIZE / 2) {
+        handoff_bump(&log_wake);
+    }
+}
+
+#define printf(...) log_printf(__VA_ARGS__)
+
+static void write_all(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t done = write(fd, buf, len);
+
+        if (done <= 0) {
+            return;
+        }
+        buf += done;
+        len -= done;
+    }
+}
+
+/* restores the heap of cursors below i, smallest seq on top */
+static void log_sift(int i, int n) {
+    while (2 * i + 1 < n) {
+        int child = 2 * i + 1;
+        struct log_cursor swap;
+
+        if (child + 1 < n && log_cursors[child + 1].rec.seq < log_cursors[child].rec.seq) {
+            child++;
+        }
+        if (log_cursors[i].rec.seq <= log_cursors[child].rec.seq) {
+            return;
+        }
+        swap = log_cursors[i];
+        log_cursors[i] = log_cursors[child];
+        log_cursors[child] = swap;
+        i = child;
+    }
+}
+
+/*
+ * Writes out, in log_seq order, the messages below the watermark (the
+ * first number taken but not yet in a ring), up to LOG_BATCH bytes. A
+ * ring holds its thread's messages in order, so merging the rings by
+ * their oldest message gives the order of all. The rest stays in the
+ * rings for the next call. Returns the number of messages written.
+ */
+static int log_flush(void) {
+    struct log_ring *ring;
+    unsigned long watermark = atomic_load(&log_seq);
+    size_t used = 0;
+    size_t term_len = 0;
+    size_t file_len = 0;
+    long dropped;
+    int rings = 0;
+    int count = 0;
+    int i;
+
+    for (ring = atomic_load(&log_rings); ring != NULL; ring = ring->next) {
+        unsigned long busy = atomic_load(&ring->busy);
+        size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+        size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+
+        if (busy != 0 && busy - 1 < watermark) {
+            watermark = busy - 1;
+        }
+        if (head == tail) {
+            continue;
+        }
+        if (rings == log_cursor_room) {
+            int room = log_cursor_room > 0 ? 2 * log_cursor_room : 64;
+            struct log_cursor *more = realloc(log_cursors, room * sizeof(struct log_cursor));
+
+            if (more == NULL) {
+                /* a ring left out may hold the next message: write nothing this time */
+                return 0;
+            }
+            log_cursors = more;
+            log_cursor_room = room;
+        }
+        log_cursors[rings].ring = ring;
+        log_cursors[rings].head = head;
+        log_cursors[rings].tail = tail;
+        ring_copy_out(ring, head, &log_cursors[rings].rec, sizeof(struct log_record));
+        rings++;
+    }
+
+    for (i = rings / 2 - 1; i >= 0; i--) {
+        log_sift(i, rings);
+    }
+    while (rings > 0 && count < LOG_BATCH_RECORDS) {
+        struct log_cursor *c = &log_cursors[0];
+
+        if (c->rec.seq >= watermark || used + c->rec.len > LOG_BATCH) {
+            break;
+        }
+        ring_copy_out(c->ring, c->head + sizeof(struct log_record), log_batch + used, c->rec.len);
+        log_entries[count].ns = c->rec.ns;
+        log_entries[count].tid = c->rec.tid;
+        log_entries[count].len = c->rec.len;
+        log_entries[count].at = used;
+        count++;
+        used += c->rec.len;
+
+        c->head += sizeof(struct log_record) + c->rec.len;
+        atomic_store_explicit(&c->ring->head, c->head, memory_order_release);
+        if (c->head != c->tail) {
+            ring_copy_out(c->ring, c->head, &c->rec, sizeof(struct log_record));
+        } else {
+            log_cursors[0] = log_cursors[--rings];
+        }
+        log_sift(0, rings);
+    }
+
+    for (i = 0; i < count; i++) {
+        long long t = log_entries[i].ns - log_start_ns;
+
+        memcpy(log_out_term + term_len, log_batch + log_entries[i].at, log_entries[i].len);
+        term_len += log_entries[i].len;
+
+        file_len += snprintf(log_out_file + file_len, LOG_PREFIX, "[%lld.%06lld %d] ", t / 1000000000LL,
+                            t / 1000 % 1000000, log_entries[i].tid);
+        memcpy(log_out_file + file_len, log_batch + log_entries[i].at, log_entries[i].len);
+        file_len += log_entries[i].len;
+    }
+
+    dropped = atomic_exchange(&log_dropped, 0);
+    if (dropped > 0) {
+        file_len += snprintf(log_out_file + file_len, LOG_PREFIX, "[log] %ld messages dropped\n", dropped);
+    }
+
+    write_all(STDOUT_FILENO, log_out_term, term_len);
+    if (log_fp != NULL) {
+        write_all(fileno(log_fp), log_out_file, file_len);
+    }
+    return count;
+}
+
+static void *log_flusher(void *arg) {
+    struct timespec tick = { 0, LOG_FLUSH_MS * 1000000L };
+    unsigned key;
+
+    (void)arg;
+
+    while (1) {
+        key = atomic_load(&log_wake);
+        if (log_flush() > 0) {
+            continue;
+        }
+        if (atomic_load(&log_stop)) {
+            break;
+        }
+        /* sleep until a ring fills up, log_close, or the next tick */
+        if (atomic_compare_exchange_strong(&log_wake, &key, key | PARKED)) {
+            futex_wait(&log_wake, key | PARKED, &tick);
+        }
+    }
+    return NULL;
+}
+
+static void log_free(void) {
+    free(log_batch);
+    free(log_entries);
+    free(log_cursors);
+    log_cursors = NULL;
+    log_cursor_room = 0;
+    free(log_out_term);
+    free(log_out_file);
+}
+
+static int log_open(const char *path) {
+    log_batch = malloc(LOG_BATCH);
+    log_entries = malloc(LOG_BATCH_RECORDS * sizeof(struct log_entry));
+    log_out_term = malloc(LOG_BATCH);
+    log_out_file = malloc(LOG_BATCH + LOG_BATCH_RECORDS * LOG_PREFIX + LOG_PREFIX);
+    if (log_batch == NULL || log_entries == NULL || log_out_term == NULL || log_out_file == NULL) {
+        log_free();
+        return -1;
+    }
+
+    log_fp = fopen(path, "a");
+    if (log_fp == NULL) {
+        log_free();
+        return -1;
+    }
+
+    log_start_ns = log_now_ns();
+    pthread_key_create(&log_key, log_release);
+    if (pthread_create(&log_tid, NULL, log_flusher, NULL) != 0) {
+        fclose(log_fp);
+        log_fp = NULL;
+        pthread_key_delete(log_key);
+        log_free();
+        return -1;
+    }
+    return 0;
+}
+
+/* writes out everything logged so far and stops the flusher */
+static void log_close(void) {
+    struct log_ring *ring;
+
+    atomic_store(&log_stop, 1);
+    handoff_bump(&log_wake);
+    pthread_join(log_tid, NULL);
+
+    while ((ring = atomic_load(&log_rings)) != NULL) {
+        atomic_store(&log_rings, ring->next);
+        free(ring);
+    }
+    log_mine = NULL;
+
+    fclose(log_fp);
+    log_fp = NULL;
+    pthread_key_delete(log_key);
+    log_free();
+}
+
+/*
+ * c3. Waiting room of one TA: a bounded queue of chair numbers. Any
+ * student can push and any TA can pop (its owner, or a TA stealing),
+ * without a lock: every slot has a sequence number saying whose turn it
+ * is, and a push or pop claims its position with one compare-and-swap
+ * (Vyukov's bounded queue). A full or empty queue is reported at once.
+ */
+struct slot {
+    atomic_long seq;
+    int chair;
+};
+
+struct ring {
+    struct slot *slots;
+    long mask;                             /* slots - 1, a power of two */
+    _Alignas(64) atomic_long tail;         /* next push */
+    _Alignas(64) atomic_long head;         /* next pop */
+};
+
+static int ring_init(struct ring *r, int size) {
+    long slots = 1;
+    long i;
+
+    while (slots < size) {
+        slots *= 2;
+    }
+    r->slots = malloc(slots * sizeof(struct slot));
+    if (r->slots == NULL) {
+        return -1;
+    }
+    for (i = 0; i < slots; i++) {
+        atomic_init(&r->slots[i].seq, i);
+    }
+    r->mask = slots - 1;
+    atomic_init(&r->tail, 0);
+    atomic_init(&r->head, 0);
+    return 0;
+}
+
+/* 1 if chair was queued, 0 if the queue is full */
+static int ring_push(struct ring *r, int chair) {
+    long pos = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    struct slot *s;
+
+    while (1) {
+        long seq;
+
+        s = &r->slots[pos & r->mask];
+        seq = atomic_load_explicit(&s->seq, memory_order_acquire);
+        if (seq == pos) {
+            if (atomic_compare_exchange_weak_explicit(&r->tail, &pos, pos + 1, memory_order_relaxed,
+                                                      memory_order_relaxed)) {
+                break;
+            }
+        } else if (seq < pos) {
+            return 0;
+        } else {
+            pos = atomic_load_explicit(&r->tail, memory_order_relaxed);
+        }
+    }
+
+    s->chair = chair;
+    atomic_store_explicit(&s->seq, pos + 1, memory_order_release);
+    return 1;
+}
+
+/* oldest chair in the queue, or -1 if it is empty */
+static int ring_pop(struct ring *r) {
+    long pos = atomic_load_explicit(&r->head, memory_order_relaxed);
+    struct slot *s;
+    int chair;
+
+    while (1) {
+        long seq;
+
+        s = &r->slots[pos & r->mask];
+        seq = atomic_load_explicit(&s->seq, memory_order_acquire);
+        if (seq == pos + 1) {
+            if (atomic_compare_exchange_weak_explicit(&r->head, &pos, pos + 1, memory_order_relaxed,
+                                                      memory_order_relaxed)) {
+                break;
+            }
+        } else if (seq < pos + 1) {
+            return -1;
+        } else {
+            pos = atomic_load_explicit(&r->head, memory_order_relaxed);
+        }
+    }
+
+    chair = s->chair;
+    atomic_store_explicit(&s->seq, pos + r->mask + 1, memory_order_release);
+    return chair;
+}
+
+/* students queued, possibly a moment out of date */
+static long ring_count(struct ring *r) {
+    return atomic_load(&r->tail) - atomic_load(&r->head);
+}
+
+/* student_state[i] */
+#define STUDENT_WAITING 0u
+#define STUDENT_CALLED 2u
+#define STUDENT_DONE 4u
+
+/* office of a TA: nobody, the TA busy with a queued student, or the student called in */
+#define OFFICE_FREE 0
+#define OFFICE_BUSY -1
+
+/* one TA and the queue of chairs whose students wait for them */
+struct ta {
+    char name[16];             /* "TA", or "TA 3" when there are several */
+    struct ring queue;
+    atomic_int office;         /* OFFICE_FREE, OFFICE_BUSY or a student id */
+    atomic_int sleeping;
+    atomic_uint wake;          /* d2. eventcount students move on to wake the TA */
+    sem_t students_waiting;    /* ... or this with -h semaphore runs */
+    long served;               /* written by the TA only */
+    long steals;
+};
+
+atomic_int waiting = 0;
+atomic_int *chairs = NULL;
+int num_chairs = CHAIRS;
+atomic_uint next_seat = 0;
+int num_students = 0;
+int num_tas = 1;
+atomic_int running = 1;
+atomic_int arriving = 0;        /* students between checking running and queueing */
+int time_unit = 1000000;       /* microseconds per second of programming or help */
+atomic_long balked = 0;
+int back_off = 0;              /* -e: students turned away come back later each time in a row */
+
+struct ta *tas = NULL;
+atomic_uint *student_state = NULL;
+
+/* -h: the semaphores handoffs used before, for comparison */
+int handoff_sem = 0;
+sem_t *student_called = NULL;
+sem_t *student_done = NULL;
+
+/* -h: when each student was last called or let go, and the latencies seen */
+int measure_handoffs = 0;
+atomic_llong *handoff_at = NULL;
+long long *handoff_ns = NULL;
+atomic_long handoff_count = 0;
+atomic_long handoff_waits = 0;          /* waits of students and TAs for a handoff */
+atomic_long handoff_switches = 0;       /* context switches of the waiting threads during those waits */
+
+pthread_t *ta_tids = NULL;
+pthread_t *student_tids = NULL;
+int *student_ids = NULL;
+
+/* threads start together once all of them exist */
+pthread_mutex_t gate_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t gate_cond = PTHREAD_COND_INITIALIZER;
+int gate_open = 0;
+
+static void wait_gate(void) {
+    pthread_mutex_lock(&gate_mutex);
+    while (!gate_open) {
+        pthread_cond_wait(&gate_cond, &gate_mutex);
+    }
+    pthread_mutex_unlock(&gate_mutex);
+}
+
+int rand_range(int low, int high) {
+    return low + rand() % (high - low + 1);
+}
+
+void pass_time(int t) {
+    if (time_unit == 1000000) {
+        sleep(t);
+    } else {
+        usleep((useconds_t)(t * time_unit));
+    }
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static long long now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* how many times longer a student turned away `balks` times in a row programs (1 without -e) */
+static int back_off_factor(int balks) {
+    if (!back_off || balks <= 1) {
+        return 1;
+    }
+    return 1 << (balks - 1 < BACKOFF_MAX ? balks - 1 : BACKOFF_MAX);
+}
+
+/* c1. Student programs for random time, longer after balks in a row with -e */
+void program_time(int id, int balks) {
+    int t = rand_range(1, 5) * back_off_factor(balks);
+    printf("Student %d is programming for %d seconds.\n", id, t);
+    pass_time(t);
+}
+
+/* c6. Each TA helps one student at a time */
+void help_time(struct ta *ta, int id) {
+    int t = rand_range(1, 3);
+    printf("%s is helping student %d for %d seconds.\n", ta->name, id, t);
+    pass_time(t);
+    printf("%s finished helping student %d.\n", ta->name, id);
+}
+
+/* d2. wakes ta if it sleeps */
+static void wake_ta(struct ta *ta) {
+    if (handoff_sem) {
+        sem_post(&ta->students_waiting);
+    } else {
+        handoff_bump(&ta->wake);
+    }
+}
+
+/* taken before ta looks for work, so a student arriving after that still wakes it */
+static unsigned ta_wake_key(struct ta *ta) {
+    return handoff_sem ? 0 : atomic_load(&ta->wake) & ~PARKED;
+}
+
+/* -h: the calling thread's context switches so far */
+static long thread_switches(void) {
+    struct rusage usage;
+
+    getrusage(RUSAGE_THREAD, &usage);
+    return usage.ru_nvcsw + usage.ru_nivcsw;
+}
+
+/* -h: counts the switches of one wait that started at `before` */
+static void count_switches(long before) {
+    atomic_fetch_add(&handoff_waits, 1);
+    atomic_fetch_add(&handoff_switches, thread_switches() - before);
+}
+
+static void ta_sleep(struct ta *ta, unsigned key) {
+    long before = measure_handoffs ? thread_switches() : 0;
+
+    if (handoff_sem) {
+        sem_wait(&ta->students_waiting);
+    } else {
+        handoff_wait(&ta->wake, key);
+    }
+
+    if (measure_handoffs) {
+        count_switches(before);
+    }
+}
+
+/* d3, d4. the TA calls student id in (STUDENT_CALLED) or lets them go (STUDENT_DONE) */
+static void tell_student(int id, unsigned state) {
+    int which = state == STUDENT_DONE;
+
+    if (measure_handoffs) {
+        atomic_store(&handoff_at[2 * (id - 1) + which], now_ns());
+    }
+    if (handoff_sem) {
+        sem_post(which ? &student_done[id - 1] : &student_called[id - 1]);
+    } else {
+        handoff_set(&student_state[id - 1], state);
+    }
+}
+
+/* student id waits until the TA moves their state on from `from` */
+static void wait_for_ta(int id, unsigned from) {
+    int which = from == STUDENT_CALLED;
+    long before = measure_handoffs ? thread_switches() : 0;
+    long n;
+
+    if (handoff_sem) {
+        sem_wait(which ? &student_done[id - 1] : &student_called[id - 1]);
+    } else {
+        handoff_wait(&student_state[id - 1], from);
+    }
+
+    if (measure_handoffs) {
+        count_switches(before);
+        n = atomic_fetch_add(&handoff_count, 1);
+        if (n < HANDOFF_SAMPLES) {
+            handoff_ns[n] = now_ns() - atomic_load(&handoff_at[2 * (id - 1) + which]);
+        }
+    }
+}
+
+/* calls student id into the office of a free TA, trying the student's own TA first */
+static struct ta *idle_ta(int id) {
+    int i;
+
+    for (i = 0; i < num_tas; i++) {
+        struct ta *ta = &tas[(id - 1 + i) % num_tas];
+        int expected = OFFICE_FREE;
+
+        if (ring_count(&ta->queue) == 0 &&
+            atomic_compare_exchange_strong(&ta->office, &expected, id)) {
+            return ta;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * c3. Seats student id in a free chair and queues them for home.
+ * Returns the chair, or -1 at once if every chair is taken.
+ */
+static int seat_student(struct ta *home, int id) {
+    int now = atomic_load(&waiting);
+    int seat;
+
+    /* the chairs bound how many wait in all queues together */
+    do {
+        if (now >= num_chairs) {
+            return -1;
+        }
+    } while (!atomic_compare_exchange_weak(&waiting, &now, now + 1));
+
+    /* a chair is free or about to be: its student has been taken off a queue */
+    seat = (int)(atomic_fetch_add(&next_seat, 1) % (unsigned)num_chairs);
+    while (1) {
+        int expected = -1;
+
+        if (atomic_compare_exchange_strong(&chairs[seat], &expected, id)) {
+            break;
+        }
+        seat = (seat + 1) % num_chairs;
+    }
+    printf("Student %d sits in chair %d.\n", id, seat);
+
+    while (!ring_push(&home->queue, seat)) {
+        /* a TA is still finishing a pop of the slot */
+        sched_yield();
+    }
+
+    printf("Student %d is waiting. Total waiting: %d\n", id, now + 1);
+    return seat;
+}
+
+/* takes the oldest student in ring from, or returns 0 if it is empty */
+static int take_student(struct ta *ta, struct ta *from) {
+    int seat = ring_pop(&from->queue);
+    int id;
+    int left;
+
+    if (seat == -1) {
+        return 0;
+    }
+
+    id = atomic_exchange(&chairs[seat], -1);
+    left = atomic_fetch_sub(&waiting, 1) - 1;
+
+    if (from != ta) {
+        ta->steals++;
+        printf("%s takes student %d from the queue of %s.\n", ta->name, id, from->name);
+    }
+    printf("%s calls student %d. Waiting students left: %d\n", ta->name, id, left);
+    return id;
+}
+
+/* next student for ta, or 0 if nobody is waiting anywhere; the office stays taken until help is done */
+static int next_student(struct ta *ta) {
+    int expected = OFFICE_FREE;
+    int id;
+
+    if (!atomic_compare_exchange_strong(&ta->office, &expected, OFFICE_BUSY)) {
+        id = expected;
+        printf("%s starts helping student %d immediately.\n", ta->name, id);
+        return id;
+    }
+
+    id = take_student(ta, ta);
+
+    /* c8. An idle TA takes the oldest student of the longest queue */
+    while (id == 0) {
+        struct ta *from = NULL;
+        long most = 0;
+        int i;
+
+        for (i = 0; i < num_tas; i++) {
+            long count = ring_count(&tas[i].queue);
+
+            if (count > most) {
+                most = count;
+                from = &tas[i];
+            }
+        }
+        if (from == NULL) {
+            break;
+        }
+        id = take_student(ta, from);
+    }
+
+    if (id == 0) {
+        atomic_store(&ta->office, OFFICE_FREE);
+    }
+    return id;
+}
+
+void *ta_work(void *arg) {
+    struct ta *ta = arg;
+    unsigned key;
+    int id;
+
+    wait_gate();
+
+    while (1) {
+        key = ta_wake_key(ta);
+        id = next_student(ta);
+        while (id == 0) {
+            /* nobody is waiting and nobody can still arrive */
+            if (!atomic_load(&running) && atomic_load(&arriving) == 0) {
+                id = next_student(ta);
+                if (id == 0) {
+                    return NULL;
+                }
+                break;
+            }
+
+            /* c7. TA sleeps again if nobody is waiting */
+            if (!atomic_load(&ta->sleeping)) {
+                atomic_store(&ta->sleeping, 1);
+                printf("%s is sleeping.\n", ta->name);
+            }
+
+            /* d2. wake wakes TA */
+            ta_sleep(ta, key);
+
+            key = ta_wake_key(ta);
+            id = next_student(ta);
+        }
+
+        atomic_store(&ta->sleeping, 0);
+
+        /* d3. student_state[i] = STUDENT_CALLED calls one student */
+        tell_student(id, STUDENT_CALLED);
+
+        help_time(ta, id);
+
+        /* d4. student_state[i] = STUDENT_DONE tells student help is done */
+        tell_student(id, STUDENT_DONE);
+
+        ta->served++;
+        atomic_store(&ta->office, OFFICE_FREE);
+    }
+
+    return NULL;
+}
+
+/* ends an arrival; while closing, every TA rechecks whether anyone is left */
+static void arrival_done(void) {
+    int i;
+
+    if (atomic_fetch_sub(&arriving, 1) == 1 && !atomic_load(&running)) {
+        for (i = 0; i < num_tas; i++) {
+            wake_ta(&tas[i]);
+        }
+    }
+}
+
+void *student_work(void *arg) {
+    int id = *(int *)arg;
+    struct ta *home = &tas[(id - 1) % num_tas];
+    struct ta *ta;
+    struct ta *thief;
+    int balks = 0;
+    int i;
+
+    wait_gate();
+
+    while (1) {
+        /* c1. Student programs for random time */
+        program_time(id, balks);
+
+        /* c2. Student asks a TA for help */
+        /* d1. Atomics protect shared data */
+        atomic_store(&student_state[id - 1], STUDENT_WAITING);
+        atomic_fetch_add(&arriving, 1);
+
+        if (!atomic_load(&running)) {
+            arrival_done();
+            break;
+        }
+
+        if (atomic_load(&waiting) == 0 && (ta = idle_ta(id)) != NULL) {
+            /* c5. If a TA is sleeping, student wakes that TA */
+            if (atomic_load(&ta->sleeping)) {
+                printf("Student %d wakes up %s and gets immediate help.\n", id,
+                       num_tas == 1 ? "the TA" : ta->name);
+            } else {
+                printf("Student %d finds %s available and gets immediate help.\n", id, ta->name);
+            }
+
+            /* d2. wake wakes TA */
+            wake_ta(ta);
+            arrival_done();
+            balks = 0;
+
+            /* d3. student_state[i] = STUDENT_CALLED calls one student */
+            wait_for_ta(id, STUDENT_WAITING);
+            printf("Student %d goes into the office for help.\n", id);
+
+            /* d4. student_state[i] = STUDENT_DONE tells student help is done */
+            wait_for_ta(id, STUDENT_CALLED);
+            printf("Student %d leaves the office.\n", id);
+        }
+        /* c3. If chair available, student waits in the queue of their TA */
+        else if (seat_student(home, id) != -1) {
+            /* c8. a busy TA's student can be taken by a sleeping one */
+            thief = NULL;
+            if (atomic_load(&home->office) != OFFICE_FREE) {
+                for (i = 0; i < num_tas && thief == NULL; i++) {
+                    if (atomic_load(&tas[i].sleeping) && &tas[i] != home) {
+                        thief = &tas[i];
+                    }
+                }
+            }
+
+            /* d2. wake wakes TA */
+            wake_ta(home);
+            if (thief != NULL) {
+                wake_ta(thief);
+            }
+            arrival_done();
+            balks = 0;
+
+            /* d3. student_state[i] = STUDENT_CALLED calls one student */
+            wait_for_ta(id, STUDENT_WAITING);
+            printf("Student %d goes into the office for help.\n", id);
+
+            /* d4. student_state[i] = STUDENT_DONE tells student help is done */
+            wait_for_ta(id, STUDENT_CALLED);
+            printf("Student %d leaves the office.\n", id);
+        } else {
+            /* c4. If no chair, student comes back later */
+            atomic_fetch_add(&balked, 1);
+            printf("Student %d found no empty chair and will come back later.\n", id);
+            arrival_done();
+            balks++;
+        }
+    }
+
+    return NULL;
+}
+
+static void free_arrays(void) {
+    int i;
+
+    for (i = 0; tas != NULL && i < num_tas; i++) {
+        free(tas[i].queue.slots);
+    }
+
+    free(tas);
+    free(chairs);
+    free(ta_tids);
+    free(student_tids);
+    free(student_ids);
+    free(student_state);
+    free(student_called);
+    free(student_done);
+    free(handoff_at);
+    free(handoff_ns);
+
+    tas = NULL;
+    chairs = NULL;
+    ta_tids = NULL;
+    student_tids = NULL;
+    student_ids = NULL;
+    student_state = NULL;
+    student_called = NULL;
+    student_done = NULL;
+    handoff_at = NULL;
+    handoff_ns = NULL;
+}
 
-    pthread_mutex_lock(&log_mutex);
+static void cleanup(void) {
+    int i;
 
-    va_start(args, fmt);
-    vprintf(fmt, args);
-    va_end(args);
-    fflush(stdout);
+    for (i = 0; i < num_tas; i++) {
+        sem_destroy(&tas[i].students_waiting);
+    }
 
-    if (log_fp != NULL) {
-        va_start(args, fmt);
-        vfprintf(log_fp, fmt, args);
-        va_end(args);
-        fflush(log_fp);
+    for (i = 0; student_called != NULL && i < num_students; i++) {
+        sem_destroy(&student_called[i]);
+        sem_destroy(&student_done[i]);
     }
 
-    pthread_mutex_unlock(&log_mutex);
+    free_arrays();
 }
 
-#define printf(...) log_printf(__VA_ARGS__)
+/*
+ * Runs the office with num_tas TAs. With seconds == 0 it runs until
+ * killed; otherwise it stops admitting students after that long, lets
+ * the TAs finish everyone already seated, and returns the elapsed time
+ * (or -1 on error).
+ */
+static double run_office(int seconds) {
+    int created_tas = 0;
+    int created_students = 0;
+    double start;
+    double elapsed;
+    int i;
 
-int waiting = 0;
-int chairs[CHAIRS];
-int next_seat = 0;
-int next_teach = 0;
-int num_students = 0;
+    /* a2. Initialize shared variables */
+    atomic_store(&waiting, 0);
+    atomic_store(&next_seat, 0);
+    atomic_store(&running, 1);
+    atomic_store(&arriving, 0);
+    atomic_store(&balked, 0);
+    gate_open = 0;
 
-int ta_sleeping = 1;
-int ta_busy = 0;
-int current_student = 0;
+    /* a4. Allocate arrays for threads, ids, semaphores */
+    /* the queue ends sit on their own cache lines */
+    tas = aligned_alloc(64, num_tas * sizeof(struct ta));
+    if (tas != NULL) {
+        memset(tas, 0, num_tas * sizeof(struct ta));
+    }
+    chairs = malloc(num_chairs * sizeof(atomic_int));
+    ta_tids = malloc(num_tas * sizeof(pthread_t));
+    student_tids = malloc(num_students * sizeof(pthread_t));
+    student_ids = malloc(num_students * sizeof(int));
+    student_state = calloc(num_students, sizeof(atomic_uint));
+    if (handoff_sem) {
+        student_called = malloc(num_students * sizeof(sem_t));
+        student_done = malloc(num_students * sizeof(sem_t));
+    }
+    if (measure_handoffs) {
+        atomic_store(&handoff_count, 0);
+        atomic_store(&handoff_waits, 0);
+        atomic_store(&handoff_switches, 0);
+        handoff_at = calloc(2 * num_students, sizeof(atomic_llong));
+        handoff_ns = malloc(HANDOFF_SAMPLES * sizeof(long long));
+    }
 
-pthread_mutex_t mutex;
-sem_t students_waiting;
-sem_t *student_called = NULL;
-sem_t *student_done = NULL;
+    for (i = 0; tas != NULL && i < num_tas; i++) {
+        if (ring_init(&tas[i].queue, num_chairs) != 0) {
+            break;
+        }
+    }
 
-pthread_t ta_tid;
-pthread_t *student_tids = NULL;
-int *student_ids = NULL;
+    if (tas == NULL || i < num_tas || chairs == NULL || ta_tids == NULL || student_tids == NULL ||
+        student_ids == NULL || student_state == NULL ||
+        (handoff_sem && (student_called == NULL || student_done == NULL)) ||
+        (measure_handoffs && (handoff_at == NULL || handoff_ns == NULL))) {
+        fprintf(stderr, "Memory allocation failed.\n");
+        free_arrays();
+        return -1;
+    }
 
-int rand_range(int low, int high) {
-    return low + rand() % (high - low + 1);
-}
+    for (i = 0; i < num_chairs; i++) {
+        atomic_init(&chairs[i], -1);
+    }
 
-/* c1. Student programs for random time */
-void program_time(int id) {
-    int t = rand_range(1, 5);
-    printf("Student %d is programming for %d seconds.\n", id, t);
-    sleep(t);
-}
+    /* a3. Initialize semaphores (the TAs' are only used by -h) */
+    for (i = 0; i < num_tas; i++) {
+        if (num_tas == 1) {
+            snprintf(tas[i].name, sizeof(tas[i].name), "TA");
+        } else {
+            snprintf(tas[i].name, sizeof(tas[i].name), "TA %d", i + 1);
+        }
+        sem_init(&tas[i].students_waiting, 0, 0);
+    }
 
-/* c6. TA helps one student at a time */
-void help_time(int id) {
-    int t = rand_range(1, 3);
-    printf("TA is helping student %d for %d seconds.\n", id, t);
-    sleep(t);
-    printf("TA finished helping student %d.\n", id);
+    for (i = 0; handoff_sem && i < num_students; i++) {
+        sem_init(&student_called[i], 0, 0);
+        sem_init(&student_done[i], 0, 0);
+    }
+
+    /* b1. Create the TA threads */
+    for (i = 0; i < num_tas; i++) {
+        if (pthread_create(&ta_tids[i], NULL, ta_work, &tas[i]) != 0) {
+            fprintf(stderr, "Could not create TA thread %d.\n", i + 1);
+            break;
+        }
+        created_tas++;
+    }
+
+    /* b2. Create n student threads */
+    /* b3. Give each student a unique id */
+    for (i = 0; i < num_students && created_tas == num_tas; i++) {
+        student_ids[i] = i + 1;
+
+        if (pthread_create(&student_tids[i], NULL, student_work, &student_ids[i]) != 0) {
+            fprintf(stderr, "Could not create student thread %d.\n", i + 1);
+            break;
+        }
+        created_students++;
+    }
+
+    pthread_mutex_lock(&gate_mutex);
+    gate_open = 1;
+    pthread_cond_broadcast(&gate_cond);
+    pthread_mutex_unlock(&gate_mutex);
+    start = now_seconds();
+
+    if (created_tas == num_tas && created_students == num_students && seconds > 0) {
+        sleep(seconds);
+    }
+
+    if (created_tas < num_tas || created_students < num_students || seconds > 0) {
+        atomic_store(&running, 0);
+
+        for (i = 0; i < created_tas; i++) {
+            wake_ta(&tas[i]);
+        }
+    }
+
+    for (i = 0; i < created_tas; i++) {
+        pthread_join(ta_tids[i], NULL);
+    }
+
+    /* everyone admitted has been helped */
+    elapsed = now_seconds() - start;
+
+    for (i = 0; i < created_students; i++) {
+        pthread_join(student_tids[i], NULL);
+    }
+
+    if (created_tas < num_tas || created_students < num_students) {
+        cleanup();
+        return -1;
+    }
+    return elapsed;
 }
 
-void *ta_work(void *arg) {
-    int id;
+/* -b: requests served per second from 1 to MAX_TAS TAs */
+static int run_bench(void) {
+    double base = 0;
+    double elapsed;
+    double rate;
+    long served;
+    long steals;
+    int i;
 
-    (void)arg;
+    time_unit = BENCH_TIME_UNIT;
 
-    while (1) {
-        pthread_mutex_lock(&mutex);
+    printf("%d students, %d chairs, programming 1-5 ms, help 1-3 ms, %d s per run\n",
+           num_students, num_chairs, BENCH_SECONDS);
+    printf("%5s %10s %12s %8s %10s %10s\n", "TAs", "Served", "Served/s", "Speedup", "Steals", "Balked");
 
-        /* c7. TA sleeps again if nobody is waiting */
-        if (!ta_busy && waiting == 0 && current_student == 0) {
-            ta_sleeping = 1;
-            printf("TA is sleeping.\n");
+    for (num_tas = 1; num_tas <= MAX_TAS; num_tas *= 2) {
+        log_quiet = 1;
+        elapsed = run_office(BENCH_SECONDS);
+        if (elapsed < 0) {
+            return 1;
         }
 
-        pthread_mutex_unlock(&mutex);
+        served = 0;
+        steals = 0;
+        for (i = 0; i < num_tas; i++) {
+            served += tas[i].served;
+            steals += tas[i].steals;
+        }
+        rate = served / elapsed;
+        if (num_tas == 1) {
+            base = rate;
+        }
 
-        /* d2. students_waiting wakes TA */
-        sem_wait(&students_waiting);
+        log_quiet = 0;
+        printf("%5d %10ld %12.0f %7.2fx %10ld %10ld\n", num_tas, served, rate,
+               base > 0 ? rate / base : 0.0, steals, atomic_load(&balked));
+        cleanup();
+    }
 
-        pthread_mutex_lock(&mutex);
-        ta_sleeping = 0;
+    return 0;
+}
 
-        /* c6. TA helps one student at a time */
-        if (current_student != 0) {
-            id = current_student;
-            current_student = 0;
-            printf("TA starts helping student %d immediately.\n", id);
-        } else {
-            id = chairs[next_teach];
-            chairs[next_teach] = -1;
-            next_teach = (next_teach + 1) % CHAIRS;
-            waiting--;
-            ta_busy = 1;   /* FIX: mark TA busy before helping a waiting student */
+static int compare_long_long(const void *a, const void *b) {
+    long long x = *(const long long *)a;
+    long long y = *(const long long *)b;
 
-            printf("TA calls student %d. Waiting students left: %d\n", id, waiting);
+    return (x > y) - (x < y);
+}
+
+/* -h: handoff latency and the context switches of waiting for handoffs, semaphores first, then futexes */
+static int run_handoff_bench(void) {
+    double elapsed;
+    long switches;
+    long waits;
+    long served;
+    long samples;
+    int i;
+
+    time_unit = BENCH_TIME_UNIT;
+    measure_handoffs = 1;
+
+    printf("%d students, %d TAs, %d chairs, programming 1-5 ms, help 1-3 ms, %d s per run\n",
+           num_students, num_tas, num_chairs, BENCH_SECONDS);
+    printf("%-10s %10s %10s %10s %10s %12s %12s\n", "Handoff", "Served", "Served/s", "p50 us",
+           "p99 us", "Switches", "Per wait");
+
+    for (handoff_sem = 1; handoff_sem >= 0; handoff_sem--) {
+        log_quiet = 1;
+        elapsed = run_office(BENCH_SECONDS);
+        log_quiet = 0;
+        if (elapsed < 0) {
+            return 1;
         }
 
-        pthread_mutex_unlock(&mutex);
+        served = 0;
+        for (i = 0; i < num_tas; i++) {
+            served += tas[i].served;
+        }
+        samples = atomic_load(&handoff_count);
+        if (samples > HANDOFF_SAMPLES) {
+            samples = HANDOFF_SAMPLES;
+        }
+        qsort(handoff_ns, samples, sizeof(long long), compare_long_long);
+        switches = atomic_load(&handoff_switches);
+        waits = atomic_load(&handoff_waits);
+
+        printf("%-10s %10ld %10.0f %10.1f %10.1f %12ld %12.2f\n", handoff_sem ? "semaphore" : "futex",
+               served, served / elapsed, samples > 0 ? handoff_ns[samples / 2] / 1e3 : 0.0,
+               samples > 0 ? handoff_ns[samples * 99 / 100] / 1e3 : 0.0, switches,
+               waits > 0 ? (double)switches / waits : 0.0);
+        cleanup();
+    }
 
-        /* d3. student_called[i] calls one student */
-        sem_post(&student_called[id - 1]);
+    handoff_sem = 0;
+    measure_handoffs = 0;
+    return 0;
+}
 
-        help_time(id);
+/*
+ * -w: the waiting room alone. Students try to sit down as fast as they
+ * can (without waiting for help) while one TA empties it, once with
+ * the waiting room as it was before (chairs[] and its counters under
+ * one mutex) and once with the lock-free queue above.
+ */
+int room_lockfree = 0;
+pthread_mutex_t room_mutex = PTHREAD_MUTEX_INITIALIZER;
+int room_waiting = 0;
+int room_next_seat = 0;
+int room_next_teach = 0;
+long *room_arrivals = NULL;
+long room_taken = 0;
+
+static int mutex_seat(int id) {
+    int seat = -1;
+
+    pthread_mutex_lock(&room_mutex);
+    if (room_waiting < num_chairs) {
+        seat = room_next_seat;
+        atomic_store_explicit(&chairs[seat], id, memory_order_relaxed);
+        room_next_seat = (room_next_seat + 1) % num_chairs;
+        room_waiting++;
+    }
+    pthread_mutex_unlock(&room_mutex);
+    return seat;
+}
 
-        /* d4. student_done[i] tells student help is done */
-        sem_post(&student_done[id - 1]);
+static int mutex_take(void) {
+    int id = 0;
 
-        pthread_mutex_lock(&mutex);
-        ta_busy = 0;
-        pthread_mutex_unlock(&mutex);
+    pthread_mutex_lock(&room_mutex);
+    if (room_waiting > 0) {
+        id = atomic_load_explicit(&chairs[room_next_teach], memory_order_relaxed);
+        atomic_store_explicit(&chairs[room_next_teach], -1, memory_order_relaxed);
+        room_next_teach = (room_next_teach + 1) % num_chairs;
+        room_waiting--;
     }
+    pthread_mutex_unlock(&room_mutex);
+    return id;
+}
 
-    return NULL;
+/* a student turned away `balks` times in a row yields; with -e, it then sleeps twice as long each time */
+static void room_back_off(int balks) {
+    struct timespec pause = {0, 0};
+    long us;
+
+    if (!back_off || balks <= ROOM_BACKOFF_YIELDS) {
+        sched_yield();
+        return;
+    }
+    us = balks - ROOM_BACKOFF_YIELDS < 20 ? 1L << (balks - ROOM_BACKOFF_YIELDS) : ROOM_BACKOFF_MAX_US;
+    pause.tv_nsec = (us < ROOM_BACKOFF_MAX_US ? us : ROOM_BACKOFF_MAX_US) * 1000;
+    nanosleep(&pause, NULL);
 }
 
-void *student_work(void *arg) {
+static void *room_student(void *arg) {
     int id = *(int *)arg;
+    long arrivals = 0;
+    int balks = 0;
 
-    while (1) {
-        /* c1. Student programs for random time */
-        program_time(id);
+    wait_gate();
+    while (atomic_load_explicit(&running, memory_order_relaxed)) {
+        int seat = room_lockfree ? seat_student(&tas[0], id) : mutex_seat(id);
 
-        /* c2. Student asks TA for help */
-        /* d1. Mutex protects shared data */
-        pthread_mutex_lock(&mutex);
+        arrivals++;
+        if (seat == -1) {
+            /* let the TA, who is the only one who can free a chair, run */
+            room_back_off(++balks);
+        } else {
+            balks = 0;
+        }
+    }
+    room_arrivals[id - 1] = arrivals;
+    return NULL;
+}
 
-        if (!ta_busy && waiting == 0 && current_student == 0) {
-            ta_busy = 1;
-            current_student = id;
+static void *room_ta(void *arg) {
+    long taken = 0;
 
-            /* c5. If TA is sleeping, student wakes TA */
-            if (ta_sleeping) {
-                printf("Student %d wakes up the TA and gets immediate help.\n", id);
-            } else {
-                printf("Student %d finds TA available and gets immediate help.\n", id);
-            }
+    (void)arg;
 
-            pthread_mutex_unlock(&mutex);
+    wait_gate();
+    while (atomic_load_explicit(&running, memory_order_relaxed)) {
+        if ((room_lockfree ? take_student(&tas[0], &tas[0]) : mutex_take()) != 0) {
+            taken++;
+        } else {
+            /* an empty room: let the students in */
+            sched_yield();
+        }
+    }
+    room_taken = taken;
+    return NULL;
+}
+
+/*
+ * Students seated and taken by the TA per second with `students` threads,
+ * or -1 on error; *tries gets the tries (seated or turned away) per second.
+ */
+static double run_room(int students, double *tries) {
+    int created = 0;
+    long arrivals = 0;
+    double seated = 0;
+    double start;
+    double elapsed;
+    int i;
 
-            /* d2. students_waiting wakes TA */
-            sem_post(&students_waiting);
+    atomic_store(&waiting, 0);
+    atomic_store(&next_seat, 0);
+    atomic_store(&running, 1);
+    room_waiting = 0;
+    room_next_seat = 0;
+    room_next_teach = 0;
+    gate_open = 0;
+
+    tas = aligned_alloc(64, sizeof(struct ta));
+    if (tas != NULL) {
+        memset(tas, 0, sizeof(struct ta));
+    }
+    chairs = malloc(num_chairs * sizeof(atomic_int));
+    ta_tids = malloc(sizeof(pthread_t));
+    student_tids = malloc(students * sizeof(pthread_t));
+    student_ids = malloc(students * sizeof(int));
+    room_arrivals = calloc(students, sizeof(long));
+
+    if (tas == NULL || ring_init(&tas[0].queue, num_chairs) != 0 || chairs == NULL ||
+        ta_tids == NULL || student_tids == NULL || student_ids == NULL || room_arrivals == NULL) {
+        fprintf(stderr, "Memory allocation failed.\n");
+        free(room_arrivals);
+        free_arrays();
+        return -1;
+    }
+    snprintf(tas[0].name, sizeof(tas[0].name), "TA");
 
-            /* d3. student_called[i] calls one student */
-            sem_wait(&student_called[id - 1]);
-            printf("Student %d goes into the office for help.\n", id);
+    for (i = 0; i < num_chairs; i++) {
+        atomic_init(&chairs[i], -1);
+    }
 
-            /* d4. student_done[i] tells student help is done */
-            sem_wait(&student_done[id - 1]);
-            printf("Student %d leaves the office.\n", id);
+    if (pthread_create(&ta_tids[0], NULL, room_ta, NULL) != 0) {
+        fprintf(stderr, "Could not create TA thread.\n");
+        created = -1;
+    }
+    for (i = 0; i < students && created >= 0; i++) {
+        student_ids[i] = i + 1;
+        if (pthread_create(&student_tids[i], NULL, room_student, &student_ids[i]) != 0) {
+            fprintf(stderr, "Could not create student thread %d.\n", i + 1);
+            break;
         }
-        /* c3. If chair available, student waits */
-        else if (waiting < CHAIRS) {
-            chairs[next_seat] = id;
-            printf("Student %d sits in chair %d.\n", id, next_seat);
+        created++;
+    }
 
-            next_seat = (next_seat + 1) % CHAIRS;
-            waiting++;
+    pthread_mutex_lock(&gate_mutex);
+    gate_open = 1;
+    pthread_cond_broadcast(&gate_cond);
+    pthread_mutex_unlock(&gate_mutex);
+    start = now_seconds();
 
-            printf("Student %d is waiting. Total waiting: %d\n", id, waiting);
+    if (created == students) {
+        sleep(ROOM_BENCH_SECONDS);
+    }
+    atomic_store(&running, 0);
+    /* students still sleeping off a balk (-e) must not stretch the run */
+    elapsed = now_seconds() - start;
 
-            pthread_mutex_unlock(&mutex);
+    for (i = 0; i < created; i++) {
+        pthread_join(student_tids[i], NULL);
+        arrivals += room_arrivals[i];
+    }
+    if (created >= 0) {
+        pthread_join(ta_tids[0], NULL);
+        seated = room_taken / elapsed;
+    }
+    *tries = arrivals / elapsed;
 
-            /* d2. students_waiting wakes TA */
-            sem_post(&students_waiting);
+    free(room_arrivals);
+    room_arrivals = NULL;
+    free_arrays();
+    return created == students ? seated : -1;
+}
 
-            /* d3. student_called[i] calls one student */
-            sem_wait(&student_called[id - 1]);
-            printf("Student %d goes into the office for help.\n", id);
+static int run_room_bench(void) {
+    double locked;
+    double lockfree;
+    double locked_tries = 0;
+    double lockfree_tries = 0;
+    int students;
+
+    num_tas = 1;
+    printf("Waiting room with %d chairs and one TA emptying it, %d s per run, %s after a balk\n", num_chairs,
+           ROOM_BENCH_SECONDS, back_off ? "backing off" : "yielding");
+    printf("%8s %14s %18s %8s %14s %14s\n", "Students", "Mutex seated/s", "Lock-free seated/s", "Ratio",
+           "Mutex tries/s", "Lock-free tries/s");
+
+    for (students = 1; ; students = students * 2 < num_students ? students * 2 : num_students) {
+        log_quiet = 1;
+        room_lockfree = 0;
+        locked = run_room(students, &locked_tries);
+        room_lockfree = 1;
+        lockfree = locked < 0 ? -1 : run_room(students, &lockfree_tries);
+        log_quiet = 0;
+        if (locked < 0 || lockfree < 0) {
+            return 1;
+        }
 
-            /* d4. student_done[i] tells student help is done */
-            sem_wait(&student_done[id - 1]);
-            printf("Student %d leaves the office.\n", id);
-        } else {
-            /* c4. If no chair, student comes back later */
-            printf("Student %d found no empty chair and will come back later.\n", id);
-            pthread_mutex_unlock(&mutex);
+        printf("%8d %14.0f %18.0f %7.2fx %14.0f %17.0f\n", students, locked, lockfree,
+               locked > 0 ? lockfree / locked : 0.0, locked_tries, lockfree_tries);
+        if (students == num_students) {
+            break;
         }
     }
 
-    return NULL;
+    return 0;
 }
 
-static void cleanup(void) {
-    int i;
+/*
+ * -v: the same office on a virtual clock. Nobody sleeps: every student
+ * finishing programming (c1) and every TA finishing help (c6) is an
+ * event, and the clock jumps from one event to the next. Events at the
+ * same millisecond run in the order they were scheduled. The rules are
+ * the ones the threads follow: a student goes straight to a free TA if
+ * nobody waits, otherwise sits in a chair in their TA's queue, and
+ * otherwise comes back later; a TA done helping calls the oldest
+ * student of their own queue, or else of the longest queue. A student
+ * turned away comes back after 1-5 s, or with -e later each time in a
+ * row, as the threads do.
+ */
+#define SIM_ARRIVE 0                   /* a student asks for help */
+#define SIM_DONE 1                     /* a TA finishes helping */
+#define SIM_UNIT 1000                  /* clock ticks (ms) per simulated second */
+#define SIM_WAIT_ROWS 10               /* wait histogram rows of one second, the last one for longer waits */
+
+struct sim_event {
+    long long time;
+    long seq;                          /* ties run in scheduling order */
+    int kind;
+    int who;                           /* student id, or TA index */
+};
+
+/* one TA: the students in their chairs (a ring of num_chairs) and who is in the office */
+struct sim_ta {
+    int *queue;
+    int head;
+    int count;
+    int student;                       /* 0 when the office is free */
+    long long busy;                    /* ticks spent helping */
+    long served;
+    long steals;
+};
+
+struct sim_event *sim_heap = NULL;
+int sim_events = 0;
+long sim_seq = 0;
+struct sim_ta *sim_tas = NULL;
+long long *sim_seated_at = NULL;       /* when each waiting student sat down */
+int *sim_balked = NULL;                /* times each student was turned away in a row */
+long *sim_waits = NULL;                /* sessions by ticks waited */
+long long sim_wait_room = 0;           /* length of sim_waits; grows with the longest wait */
+
+static int sim_before(const struct sim_event *a, const struct sim_event *b) {
+    return a->time < b->time || (a->time == b->time && a->seq < b->seq);
+}
+
+/* the heap holds at most one event per student and per TA */
+static void sim_push(long long time, int kind, int who) {
+    struct sim_event e = { time, sim_seq++, kind, who };
+    int i = sim_events++;
 
-    pthread_mutex_destroy(&mutex);
-    sem_destroy(&students_waiting);
+    while (i > 0 && sim_before(&e, &sim_heap[(i - 1) / 2])) {
+        sim_heap[i] = sim_heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    sim_heap[i] = e;
+}
+
+static struct sim_event sim_pop(void) {
+    struct sim_event first = sim_heap[0];
+    struct sim_event last = sim_heap[--sim_events];
+    int i = 0;
+
+    while (2 * i + 1 < sim_events) {
+        int child = 2 * i + 1;
 
-    if (student_called != NULL) {
-        for (i = 0; i < num_students; i++) {
-            sem_destroy(&student_called[i]);
+        if (child + 1 < sim_events && sim_before(&sim_heap[child + 1], &sim_heap[child])) {
+            child++;
         }
+        if (!sim_before(&sim_heap[child], &last)) {
+            break;
+        }
+        sim_heap[i] = sim_heap[child];
+        i = child;
     }
+    sim_heap[i] = last;
+    return first;
+}
+
+/* c6. ta helps student id from now on; help past the end counts up to end. -1 if out of memory */
+static int sim_help(struct sim_ta *ta, int id, long long waited, long long now, long long end) {
+    long long done = now + rand_range(1 * SIM_UNIT, 3 * SIM_UNIT);
+
+    if (waited >= sim_wait_room) {
+        long long room = sim_wait_room;
+        long *more;
 
-    if (student_done != NULL) {
-        for (i = 0; i < num_students; i++) {
-            sem_destroy(&student_done[i]);
+        while (room <= waited) {
+            room *= 2;
         }
+        more = realloc(sim_waits, room * sizeof(long));
+        if (more == NULL) {
+            return -1;
+        }
+        memset(more + sim_wait_room, 0, (room - sim_wait_room) * sizeof(long));
+        sim_waits = more;
+        sim_wait_room = room;
     }
+    sim_waits[waited]++;
+    sim_balked[id - 1] = 0;
 
-    free(student_tids);
-    free(student_ids);
-    free(student_called);
-    free(student_done);
+    ta->student = id;
+    ta->busy += (done < end ? done : end) - now;
+    sim_push(done, SIM_DONE, (int)(ta - sim_tas));
+    return 0;
+}
 
-    if (log_fp != NULL) {
-        fclose(log_fp);
+/* c8. takes the oldest student of ta's queue, or else of the longest queue; 0 if none */
+static int sim_next_student(struct sim_ta *ta) {
+    struct sim_ta *from = ta;
+    int id;
+    int i;
+
+    if (ta->count == 0) {
+        for (i = 0; i < num_tas; i++) {
+            if (sim_tas[i].count > from->count) {
+                from = &sim_tas[i];
+            }
+        }
+        if (from->count == 0) {
+            return 0;
+        }
+        ta->steals++;
     }
 
-    pthread_mutex_destroy(&log_mutex);
+    id = from->queue[from->head];
+    from->head = (from->head + 1) % num_chairs;
+    from->count--;
+    return id;
 }
 
-int main(int argc, char *argv[]) {
+static void sim_free(void) {
     int i;
 
-    mkdir("logs", 0777);
-    log_fp = fopen("logs/ta_output.log", "a");
-    if (log_fp == NULL) {
-        fprintf(stderr, "Could not open log file.\n");
-        return 1;
+    for (i = 0; sim_tas != NULL && i < num_tas; i++) {
+        free(sim_tas[i].queue);
     }
+    free(sim_tas);
+    free(sim_heap);
+    free(sim_seated_at);
+    free(sim_balked);
+    free(sim_waits);
+
+    sim_tas = NULL;
+    sim_heap = NULL;
+    sim_seated_at = NULL;
+    sim_balked = NULL;
+    sim_waits = NULL;
+    sim_wait_room = 0;
+}
 
-    pthread_mutex_init(&log_mutex, NULL);
+/* the smallest wait (in ticks) that at least fraction of the sessions did not exceed */
+static long long sim_wait_percentile(long sessions, double fraction) {
+    long seen = 0;
+    long long w;
 
-    /* a1. Read number of students from command line */
-    if (argc != 2) {
-        fprintf(stderr, "Usage: %s <number_of_students>\n", argv[0]);
-        return 1;
+    for (w = 0; w < sim_wait_room - 1; w++) {
+        seen += sim_waits[w];
+        if (seen >= fraction * sessions) {
+            break;
+        }
     }
+    return w;
+}
 
-    num_students = atoi(argv[1]);
-    if (num_students <= 0) {
-        fprintf(stderr, "Number of students must be greater than 0.\n");
+static int run_simulation(long long sim_seconds) {
+    struct sim_event e;
+    struct sim_ta *ta;
+    long long end = sim_seconds * SIM_UNIT;
+    long long now = 0;
+    long long waited_total = 0;
+    long long longest;
+    long long w;
+    long events = 0;
+    long arrivals = 0;
+    long sessions = 0;
+    long balks = 0;
+    long helped = 0;
+    int waiting_now = 0;
+    int status = 0;
+    double start;
+    double elapsed;
+    int i;
+
+    /* the histogram starts at one second and doubles when a longer wait comes */
+    sim_wait_room = SIM_UNIT;
+
+    sim_heap = malloc((num_students + num_tas) * sizeof(struct sim_event));
+    sim_tas = calloc(num_tas, sizeof(struct sim_ta));
+    sim_seated_at = calloc(num_students, sizeof(long long));
+    sim_balked = calloc(num_students, sizeof(int));
+    sim_waits = calloc(sim_wait_room, sizeof(long));
+    for (i = 0; sim_tas != NULL && i < num_tas; i++) {
+        sim_tas[i].queue = malloc(num_chairs * sizeof(int));
+        if (sim_tas[i].queue == NULL) {
+            break;
+        }
+    }
+    if (sim_heap == NULL || sim_tas == NULL || i < num_tas || sim_seated_at == NULL || sim_balked == NULL ||
+        sim_waits == NULL) {
+        fprintf(stderr, "Memory allocation failed.\n");
+        sim_free();
         return 1;
     }
+    sim_events = 0;
+    sim_seq = 0;
 
-    srand((unsigned int)time(NULL));
-
-    /* a2. Initialize shared variables */
-    waiting = 0;
-    next_seat = 0;
-    next_teach = 0;
-    ta_sleeping = 1;
-    ta_busy = 0;
-    current_student = 0;
+    start = now_seconds();
 
-    for (i = 0; i < CHAIRS; i++) {
-        chairs[i] = -1;
+    /* c1. Student programs for random time */
+    for (i = 1; i <= num_students; i++) {
+        sim_push(rand_range(1 * SIM_UNIT, 5 * SIM_UNIT), SIM_ARRIVE, i);
     }
 
-    /* a3. Initialize mutex and semaphores */
-    pthread_mutex_init(&mutex, NULL);
-    sem_init(&students_waiting, 0, 0);
+    while (sim_events > 0 && sim_heap[0].time < end && status == 0) {
+        e = sim_pop();
+        now = e.time;
+        events++;
+
+        if (e.kind == SIM_DONE) {
+            ta = &sim_tas[e.who];
+            ta->served++;
+            sessions++;
+
+            /* the student goes back to programming */
+            sim_push(now + rand_range(1 * SIM_UNIT, 5 * SIM_UNIT), SIM_ARRIVE, ta->student);
+
+            ta->student = sim_next_student(ta);
+            if (ta->student != 0) {
+                waiting_now--;
+                waited_total += now - sim_seated_at[ta->student - 1];
+                /* d3. the TA calls the student in */
+                status = sim_help(ta, ta->student, now - sim_seated_at[ta->student - 1], now, end);
+            }
+            /* c7. otherwise the TA sleeps until a student comes */
+            continue;
+        }
+
+        /* c2. Student asks a TA for help */
+        arrivals++;
+        ta = NULL;
 
-    /* a4. Allocate arrays for threads, ids, semaphores */
-    student_tids = malloc(num_students * sizeof(pthread_t));
-    student_ids = malloc(num_students * sizeof(int));
-    student_called = malloc(num_students * sizeof(sem_t));
-    student_done = malloc(num_students * sizeof(sem_t));
+        /* c5. nobody waits: a free TA, the student's own first, helps at once */
+        if (waiting_now == 0) {
+            for (i = 0; i < num_tas && ta == NULL; i++) {
+                if (sim_tas[(e.who - 1 + i) % num_tas].student == 0) {
+                    ta = &sim_tas[(e.who - 1 + i) % num_tas];
+                }
+            }
+        }
+
+        if (ta != NULL) {
+            status = sim_help(ta, e.who, 0, now, end);
+        } else if (waiting_now < num_chairs) {
+            /* c3. If chair available, student waits in the queue of their TA */
+            ta = &sim_tas[(e.who - 1) % num_tas];
+            ta->queue[(ta->head + ta->count) % num_chairs] = e.who;
+            ta->count++;
+            waiting_now++;
+            sim_seated_at[e.who - 1] = now;
+            sim_balked[e.who - 1] = 0;
+        } else {
+            /* c4. If no chair, student comes back later */
+            balks++;
+            sim_balked[e.who - 1]++;
+            sim_push(now + (long long)rand_range(1 * SIM_UNIT, 5 * SIM_UNIT) * back_off_factor(sim_balked[e.who - 1]),
+                     SIM_ARRIVE, e.who);
+        }
+    }
 
-    if (student_tids == NULL || student_ids == NULL ||
-        student_called == NULL || student_done == NULL) {
+    elapsed = now_seconds() - start;
+    if (status != 0) {
         fprintf(stderr, "Memory allocation failed.\n");
-        free(student_tids);
-        free(student_ids);
-        free(student_called);
-        free(student_done);
+        sim_free();
         return 1;
     }
 
-    for (i = 0; i < num_students; i++) {
-        sem_init(&student_called[i], 0, 0);
-        sem_init(&student_done[i], 0, 0);
+    printf("%d students, %d TAs, %d chairs, programming 1-5 s, help 1-3 s, %lld simulated s%s\n",
+           num_students, num_tas, num_chairs, sim_seconds, back_off ? ", backing off after a balk" : "");
+    printf("%12s %12s %12s %12s %10s %10s\n", "Sessions", "Events", "Sessions/s", "Events/s", "Balked",
+           "Balk rate");
+    printf("%12ld %12ld %12.0f %12.0f %10ld %9.2f%%\n", sessions, events, sessions / elapsed, events / elapsed,
+           balks, arrivals > 0 ? 100.0 * balks / arrivals : 0.0);
+
+    /* every session started counts, including the last ones still running at the end */
+    for (w = 0; w < sim_wait_room; w++) {
+        helped += sim_waits[w];
+    }
+    for (longest = sim_wait_room - 1; longest > 0 && sim_waits[longest] == 0; longest--) {
     }
 
-    /* b1. Create 1 TA thread */
-    if (pthread_create(&ta_tid, NULL, ta_work, NULL) != 0) {
-        fprintf(stderr, "Could not create TA thread.\n");
-        cleanup();
-        return 1;
+    printf("\nWait (s)\n%8s %8s %8s %8s %8s\n", "mean", "p50", "p90", "p99", "max");
+    printf("%8.3f %8.3f %8.3f %8.3f %8.3f\n", helped > 0 ? (double)waited_total / helped / SIM_UNIT : 0.0,
+           (double)sim_wait_percentile(helped, 0.5) / SIM_UNIT, (double)sim_wait_percentile(helped, 0.9) / SIM_UNIT,
+           (double)sim_wait_percentile(helped, 0.99) / SIM_UNIT, (double)longest / SIM_UNIT);
+
+    /* one row per second waited */
+    printf("\n%8s %12s %8s\n", "Waited", "Sessions", "Share");
+    for (i = 0; i <= longest / SIM_UNIT; i++) {
+        long row = 0;
+        long long last = i < SIM_WAIT_ROWS - 1 ? (i + 1LL) * SIM_UNIT : longest + 1;
+
+        for (w = (long long)i * SIM_UNIT; w < last; w++) {
+            row += sim_waits[w];
+        }
+        if (i < SIM_WAIT_ROWS - 1) {
+            printf("%5d-%ds %12ld %7.2f%%\n", i, i + 1, row, helped > 0 ? 100.0 * row / helped : 0.0);
+        } else {
+            printf("%7ds+ %12ld %7.2f%%\n", i, row, helped > 0 ? 100.0 * row / helped : 0.0);
+            break;
+        }
     }
 
-    /* b2. Create n student threads */
-    /* b3. Give each student a unique id */
-    for (i = 0; i < num_students; i++) {
-        student_ids[i] = i + 1;
+    printf("\n%8s %12s %10s %12s\n", "TA", "Served", "Steals", "Utilization");
+    for (i = 0; i < num_tas; i++) {
+        printf("%8d %12ld %10ld %11.2f%%\n", i + 1, sim_tas[i].served, sim_tas[i].steals,
+               100.0 * sim_tas[i].busy / end);
+    }
 
-        if (pthread_create(&student_tids[i], NULL, student_work, &student_ids[i]) != 0) {
-            fprintf(stderr, "Could not create student thread %d.\n", i + 1);
-            cleanup();
-            return 1;
+    sim_free();
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    long long sim_seconds = 0;
+    int bench = 0;
+    int status = 0;
+    int opt;
+
+    /* a1. Read number of students (and TAs, chairs) from command line */
+    while ((opt = getopt(argc, argv, "t:c:bwhv:e")) != -1) {
+        if (opt == 't') {
+            num_tas = atoi(optarg);
+        } else if (opt == 'c') {
+            num_chairs = atoi(optarg);
+        } else if (opt == 'b' || opt == 'w' || opt == 'h') {
+            bench = opt;
+        } else if (opt == 'e') {
+            back_off = 1;
+        } else if (opt == 'v') {
+            bench = opt;
+            sim_seconds = atoll(optarg);
+        } else {
+            optind = argc + 1;
+            break;
         }
     }
 
-    pthread_join(ta_tid, NULL);
+    if (optind != argc - 1) {
+        fprintf(stderr, "Usage: %s [-t number_of_TAs] [-c number_of_chairs] [-e] [-b | -w | -h | -v simulated_seconds] <number_of_students>\n",
+                argv[0]);
+        return 1;
+    }
 
-    for (i = 0; i < num_students; i++) {
-        pthread_join(student_tids[i], NULL);
+    num_students = atoi(argv[optind]);
+    if (num_students <= 0) {
+        fprintf(stderr, "Number of students must be greater than 0.\n");
+        return 1;
+    }
+    if (num_tas <= 0 || num_tas > MAX_TAS) {
+        fprintf(stderr, "Number of TAs must be between 1 and %d.\n", MAX_TAS);
+        return 1;
+    }
+    if (num_chairs <= 0) {
+        fprintf(stderr, "Number of chairs must be greater than 0.\n");
+        return 1;
+    }
+    if (bench == 'v' && (sim_seconds <= 0 || sim_seconds > LLONG_MAX / SIM_UNIT / 2)) {
+        fprintf(stderr, "Simulated time must be between 1 and %lld seconds.\n", LLONG_MAX / SIM_UNIT / 2);
+        return 1;
     }
 
-    cleanup();
-    return 0;
-}
\ No newline at end of file
+    mkdir("logs", 0777);
+    if (log_open("logs/ta_output.log") < 0) {
+        fprintf(stderr, "Could not open log file.\n");
+        return 1;
+    }
+
+    srand((unsigned int)time(NULL));
+    if (sysconf(_SC_NPROCESSORS_ONLN) < 2) {
+        handoff_spins = 0;
+    }
+
+    if (bench == 'b') {
+        status = run_bench();
+    } else if (bench == 'w') {
+        status = run_room_bench();
+    } else if (bench == 'h') {
+        status = run_handoff_bench();
+    } else if (bench == 'v') {
+        status = run_simulation(sim_seconds);
+    } else if (run_office(0) < 0) {
+        status = 1;
+    } else {
+        cleanup();
+    }
+
+    log_close();
+    return status;
+}
@@ -10,219 +10,6686 @@ Steps:
 6. Print final statistics and clean up
 */
 
+#define _GNU_SOURCE
+
 #include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <time.h>
 #include <unistd.h>
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+/* default geometry: 256 B pages, 64 KiB logical, 32 KiB physical */
 #define PAGE_SIZE 256
 #define PAGE_BITS 8
 #define OFFSET_MASK 255
 
 #define LOGICAL_SIZE 65536
+#define LOGICAL_BITS 16
 #define PHYSICAL_SIZE 32768
 #define PAGE_COUNT (LOGICAL_SIZE / PAGE_SIZE)
 #define FRAME_COUNT (PHYSICAL_SIZE / PAGE_SIZE)
+/* Compile with -DTLB_COUNT=64 (or 256, 1024) to change the default TLB size */
+#ifndef TLB_COUNT
 #define TLB_COUNT 16
+#endif
+
+#if TLB_COUNT < 1 || TLB_COUNT > 1024
+#error "TLB_COUNT must be between 1 and 1024"
+#endif
+
+/* Compile with -DINSTRUMENT=0 to leave out --stats-out and its per-access hooks */
+#ifndef INSTRUMENT
+#define INSTRUMENT 1
+#endif
+
+/* limits for --page-size, --logical-bits, --physical-size and --tlb-size */
+#define MIN_PAGE_BITS 4
+#define MAX_PAGE_BITS 20
+#define MAX_LOGICAL_BITS 48
+#define MAX_PHYSICAL_SIZE (4ULL << 30)
+#define MAX_TLB_COUNT 65536
+/* superpage TLB entries keep one dirty bit per page */
+#define MAX_SUPERPAGE_PAGES 32
+#define SUPERPAGE_TLB_COUNT 4
+
+/* page -> value maps use a plain array up to this many pages, a hash above */
+#define PAGEMAP_FLAT_MAX (1LL << 22)
+/* the flat page table is only allowed up to this many pages */
+#define FLAT_TABLE_MAX_PAGES (1LL << 26)
+#define PAGE_TABLE_KIND_COUNT 4
+
+/*
+ * Page table entries are one 32-bit word: the frame number (2^28 frames
+ * cover 4 GiB of 16 B pages) with status and protection bits above it.
+ * 0 is an empty entry, so tables start out zeroed.
+ */
+#define PTE_FRAME_MASK ((1u << 28) - 1)
+#define PTE_REFERENCED (1u << 28)
+#define PTE_DIRTY (1u << 29)
+#define PTE_WRITABLE (1u << 30)     /* stores allowed; every page is mapped read/write */
+#define PTE_VALID (1u << 31)
+#define PTE_BITS (PTE_REFERENCED | PTE_DIRTY)
+
+#define TLB_BENCH_MAX 512
+
+/* --threads: one bit per core in the per-frame TLB holder masks */
+#define MAX_THREADS 64
+/* page table entry while a fault is loading the page (--threads) */
+#define PTE_LOADING (-2)
+
+/*
+ * Binary trace: 16 byte header, then little-endian addresses of
+ * `width` bytes each (2, 4 or 8). With TRACE_FLAG_ACCESS set in the
+ * header flags every address is followed by one access byte (0 read,
+ * 1 write).
+ */
+#define TRACE_MAGIC "VMTR"
+#define TRACE_VERSION 1
+#define TRACE_HEADER_SIZE 16
+#define TRACE_BATCH 65536
+#define TRACE_FLAG_ACCESS 1
+
+/*
+ * --generate: sequential patterns step GEN_STEP bytes at a time, Zipf
+ * ranks stop at ZIPF_MAX_PAGES pages and phases last PHASE_LENGTH accesses
+ * unless told otherwise.
+ */
+#define GEN_STEP 4
+#define ZIPF_MAX_PAGES (1 << 20)
+#define PHASE_LENGTH 100000
+#define BENCH_COUNT 1000000
+
+/* set in addresses returned by readTraceBatch for writes; masked off with the logical bits */
+#define TRACE_WRITE_BIT (1ULL << 63)
+
+/* per-address output is collected here and written one block at a time */
+#define OUT_BUFFER_SIZE (1 << 16)
+#define OUT_RECORD_SIZE 12
+#define OUT_WIDE_RECORD_SIZE 20
+
+#define POLICY_COUNT 5
+
+/* dirty pages evicted are written back to the backing store this many at a time */
+#define WRITE_BACK_BATCH 64
+
+/* stack-distance rows stop at the distinct pages touched above this */
+#define SD_MAX_ROWS 65536
+
+#define PREFETCHER_COUNT 3
+#define MAX_PREFETCH_DEGREE 32
+#define PREFETCH_DEGREE 4
+/* the stride prefetcher follows this many streams; a miss joins the nearest within the window */
+#define STREAM_COUNT 8
+#define STREAM_WINDOW 64
+
+/* defaults for the per-process allocators, in accesses of the process */
+#define WS_WINDOW 500
+#define PFF_INTERVAL 100
+/* thrashing is checked (and --timeline written) once per this many accesses */
+#define ALLOC_WINDOW 1000
 
+/* --checkpoint: accesses between snapshots unless --checkpoint-every is given */
+#define CHECKPOINT_EVERY 10000000
+#define CHECKPOINT_MAGIC "VMCK"
+#define CHECKPOINT_VERSION 1
+
+/* how frames are shared between processes */
+enum {
+    ALLOC_GLOBAL,  /* one replacement policy over all frames */
+    ALLOC_WS,      /* working set: each process keeps the pages used in its last window */
+    ALLOC_PFF      /* page-fault frequency: trimmed when its faults are far apart */
+};
+
+enum {
+    OUTPUT_FULL,   /* "Virtual address: ..." line per address */
+    OUTPUT_STATS,  /* final counters only */
+    OUTPUT_BINARY  /* (vaddr, paddr, value) records, counters on stderr */
+};
+
+/* sizes of one simulated machine, set from the command line */
 typedef struct {
-    int page;
-    int frame;
-    int valid;
+    int pageBits;
+    int logicalBits;
+    unsigned long pageSize;
+    unsigned long long physicalSize;
+    long long pageCount;
+    int frameCount;
+    int tlbCount;
+    int superpagePages;      /* pages per superpage, 0 without superpages */
+    int superpageTlbCount;
+} Geometry;
+
+/* 16 bytes: the entry's key (see tlbKey) and frame share the PTE layout */
+typedef struct {
+    long long key;  /* (asid, page) key, -1 when empty */
+    unsigned entry; /* frame | PTE_VALID, 0 when empty */
+    unsigned dirty; /* a write went through this entry (PTE_DIRTY is set); one bit per page of a superpage */
 } TLBItem;
 
-// Helpers
+/*
+ * Map from page number to a long value (-1 when absent). A plain array
+ * when the page space is small, otherwise an open-addressing hash table
+ * (linear probing, backward-shift deletion) that grows with its contents,
+ * so memory follows the pages actually touched.
+ */
+typedef struct {
+    long *flat;
+    long long *keys;
+    long *values;
+    size_t capacity;
+    size_t size;
+    long long keySpace;
+} PageMap;
+
+/*
+ * Structure-of-arrays copy of the TLB for the fully associative probes:
+ * packed page tags (-1 when empty) plus one valid bit per slot. Tags are
+ * 32 bits, so the probes need page numbers below 2^31.
+ */
+typedef struct {
+    int *tags;
+    unsigned long long *valid;
+    int count;
+} TLBTags;
+
+typedef int (*TLBProbe)(const TLBTags *t, int page);
+
+/*
+ * FIFO TLB with ASID tags. Lookups and fills are for the current
+ * address space (asid); entries of the others stay cached. A reverse
+ * index ((asid, page) -> slot) is kept in step with addToTLB/replaceTLBEntry
+ * so lookups never scan: an int per key (slot + 1, calloc'ed) up to
+ * PAGEMAP_FLAT_MAX keys, half the size of a flat PageMap, and a hashed
+ * PageMap above that. tags mirrors the entries for the fully associative
+ * probes.
+ */
+typedef struct {
+    TLBItem *items;
+    int count;
+    int next;
+    int asid;
+    int vpnBits;
+    int *slotIndex;
+    PageMap slotOfPage;      /* used when slotIndex is NULL */
+    TLBTags tags;
+} TLB;
+
+/* index and tag key of page in address space asid */
+static inline long long tlbKey(const TLB *tlb, int asid, long long page) {
+    return ((long long)asid << tlb->vpnBits) | page;
+}
+
+/* NULL means use the reverse index; otherwise probe the tags */
+static TLBProbe tlbProbe = NULL;
+
 /*
  * Arguments:
- *   tlb  - TLBItem array
+ *   t    - const TLBTags * (tags to search)
  *   page - int
  * Returns:
- *   int - frame number if page is found in the TLB, otherwise -1
+ *   int - slot holding page, otherwise -1
  */
-int findInTLB(TLBItem tlb[], int page) {
+static int probeScalar(const TLBTags *t, int page) {
+    int i;
+    for (i = 0; i < t->count; i++) {
+        if (((t->valid[i >> 6] >> (i & 63)) & 1) && t->tags[i] == page) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+#ifdef HAVE_X86_SIMD
+/* valid bits for slots [i, i + n), n <= 8 and i a multiple of 8 */
+static inline unsigned validBits(const TLBTags *t, int i, int n) {
+    return (unsigned)(t->valid[i >> 6] >> (i & 63)) & ((1u << n) - 1);
+}
+
+__attribute__((target("sse4.1")))
+static int probeSSE4(const TLBTags *t, int page) {
+    __m128i key = _mm_set1_epi32(page);
+    int i;
+
+    for (i = 0; i < t->count; i += 8) {
+        __m128i a = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *)(t->tags + i)), key);
+        __m128i b = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *)(t->tags + i + 4)), key);
+        unsigned mask = (unsigned)_mm_movemask_ps(_mm_castsi128_ps(a))
+                      | ((unsigned)_mm_movemask_ps(_mm_castsi128_ps(b)) << 4);
+        int n = t->count - i < 8 ? t->count - i : 8;
+
+        mask &= validBits(t, i, n);
+        if (mask != 0) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return -1;
+}
+
+__attribute__((target("avx2")))
+static int probeAVX2(const TLBTags *t, int page) {
+    __m256i key = _mm256_set1_epi32(page);
     int i;
-    for (i = 0; i < TLB_COUNT; i++) {
-        if (tlb[i].valid && tlb[i].page == page) {
-            return tlb[i].frame;
+
+    for (i = 0; i < t->count; i += 8) {
+        __m256i eq = _mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i *)(t->tags + i)), key);
+        unsigned mask = (unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(eq));
+        int n = t->count - i < 8 ? t->count - i : 8;
+
+        mask &= validBits(t, i, n);
+        if (mask != 0) {
+            return i + __builtin_ctz(mask);
         }
     }
     return -1;
 }
+#endif
 
 /*
  * Arguments:
- *   tlb    - TLBItem array
- *   page   - int
- *   frame  - int
- *   tlbPos - int * (current FIFO position in the TLB)
+ *   name - const char * ("index", "scalar", "sse4", "avx2" or "simd")
+ *   out  - TLBProbe * (set on success, NULL for "index")
  * Returns:
- *   void
+ *   int - 1 if the probe exists and this CPU supports it, 0 otherwise
  */
-void addToTLB(TLBItem tlb[], int page, int frame, int *tlbPos) {
-    tlb[*tlbPos].page = page;
-    tlb[*tlbPos].frame = frame;
-    tlb[*tlbPos].valid = 1;
-    *tlbPos = (*tlbPos + 1) % TLB_COUNT;
+static int selectTLBProbe(const char *name, TLBProbe *out) {
+    if (strcmp(name, "index") == 0) {
+        *out = NULL;
+        return 1;
+    }
+    if (strcmp(name, "scalar") == 0) {
+        *out = probeScalar;
+        return 1;
+    }
+#ifdef HAVE_X86_SIMD
+    __builtin_cpu_init();
+    if (strcmp(name, "avx2") == 0 || strcmp(name, "simd") == 0) {
+        if (__builtin_cpu_supports("avx2")) {
+            *out = probeAVX2;
+            return 1;
+        }
+        if (strcmp(name, "avx2") == 0) {
+            return 0;
+        }
+    }
+    if (strcmp(name, "sse4") == 0 || strcmp(name, "simd") == 0) {
+        if (__builtin_cpu_supports("sse4.1")) {
+            *out = probeSSE4;
+            return 1;
+        }
+        if (strcmp(name, "sse4") == 0) {
+            return 0;
+        }
+    }
+#endif
+    /* "simd" on a CPU without vector support falls back to scalar */
+    if (strcmp(name, "simd") == 0) {
+        *out = probeScalar;
+        return 1;
+    }
+    return 0;
 }
 
-/* 
-Arguments:
-- tlb: TLBItem array
-- oldPage: int
-- newPage: int
-- frame: int
+// Helpers
+static size_t pageHash(long long page, size_t mask) {
+    unsigned long long h = (unsigned long long)page * 0x9E3779B97F4A7C15ULL;
+    return (size_t)(h >> 32) & mask;
+}
 
-Returns:
-- int: 1 if replaced, 0 otherwise
-*/
-int replaceTLBEntry(TLBItem tlb[], int oldPage, int newPage, int frame) {
-    int i;
-    for (i = 0; i < TLB_COUNT; i++) {
-        if (tlb[i].valid && tlb[i].page == oldPage) {
-            tlb[i].page = newPage;
-            tlb[i].frame = frame;
-            return 1;
+/*
+ * Arguments:
+ *   map      - PageMap * (filled in)
+ *   keySpace - long long (number of possible pages)
+ * Returns:
+ *   int - 0 on success, -1 if allocation fails
+ */
+static int pageMapInit(PageMap *map, long long keySpace) {
+    memset(map, 0, sizeof(*map));
+    map->keySpace = keySpace;
+
+    if (keySpace <= PAGEMAP_FLAT_MAX) {
+        map->flat = malloc((size_t)keySpace * sizeof(long));
+        if (map->flat == NULL) {
+            return -1;
         }
+        memset(map->flat, -1, (size_t)keySpace * sizeof(long));
+        return 0;
+    }
+
+    map->capacity = 64;
+    map->keys = malloc(map->capacity * sizeof(long long));
+    map->values = malloc(map->capacity * sizeof(long));
+    if (map->keys == NULL || map->values == NULL) {
+        return -1;
     }
+    memset(map->keys, -1, map->capacity * sizeof(long long));
     return 0;
 }
 
-int main(void) {
-    FILE *addressFile;
-    int backingFile;
-    signed char *backingData;
-    signed char ram[PHYSICAL_SIZE];
+static void pageMapFree(PageMap *map) {
+    free(map->flat);
+    free(map->keys);
+    free(map->values);
+}
 
-    int pageTable[PAGE_COUNT];
-    int framePage[FRAME_COUNT];
-    TLBItem tlb[TLB_COUNT];
+/*
+ * Arguments:
+ *   map  - const PageMap *
+ *   page - long long
+ * Returns:
+ *   long - value stored for page, -1 if none
+ */
+static long pageMapGetHashed(const PageMap *map, long long page) {
+    size_t mask = map->capacity - 1;
+    size_t i;
 
-    int nextFrame = 0;
-    int nextTLB = 0;
-    int faults = 0;
-    int hits = 0;
-    int total = 0;
+    for (i = pageHash(page, mask); map->keys[i] != -1; i = (i + 1) & mask) {
+        if (map->keys[i] == page) {
+            return map->values[i];
+        }
+    }
+    return -1;
+}
 
-    char line[64];
-    int i;
+static inline long pageMapGet(const PageMap *map, long long page) {
+    if (map->flat != NULL) {
+        return map->flat[page];
+    }
+    return pageMapGetHashed(map, page);
+}
 
-    /* Step 1: open input files and initialize tables */
-    addressFile = fopen("addresses.txt", "r");
-    if (addressFile == NULL) {
-        perror("addresses.txt");
-        return 1;
+/* doubles the hash table; returns -1 if allocation fails */
+static int pageMapGrow(PageMap *map) {
+    long long *oldKeys = map->keys;
+    long *oldValues = map->values;
+    size_t oldCapacity = map->capacity;
+    size_t mask;
+    size_t i;
+
+    map->capacity *= 2;
+    map->keys = malloc(map->capacity * sizeof(long long));
+    map->values = malloc(map->capacity * sizeof(long));
+    if (map->keys == NULL || map->values == NULL) {
+        free(map->keys);
+        free(map->values);
+        map->keys = oldKeys;
+        map->values = oldValues;
+        map->capacity = oldCapacity;
+        return -1;
     }
+    memset(map->keys, -1, map->capacity * sizeof(long long));
 
-    backingFile = open("BACKING_STORE.bin", O_RDONLY);
-    if (backingFile < 0) {
-        perror("BACKING_STORE.bin");
-        fclose(addressFile);
-        return 1;
+    mask = map->capacity - 1;
+    for (i = 0; i < oldCapacity; i++) {
+        if (oldKeys[i] != -1) {
+            size_t j = pageHash(oldKeys[i], mask);
+            while (map->keys[j] != -1) {
+                j = (j + 1) & mask;
+            }
+            map->keys[j] = oldKeys[i];
+            map->values[j] = oldValues[i];
+        }
     }
 
-    backingData = mmap(NULL, LOGICAL_SIZE, PROT_READ, MAP_PRIVATE, backingFile, 0);
-    if (backingData == MAP_FAILED) {
-        perror("mmap");
-        close(backingFile);
-        fclose(addressFile);
-        return 1;
+    free(oldKeys);
+    free(oldValues);
+    return 0;
+}
+
+/*
+ * Arguments:
+ *   map   - PageMap *
+ *   page  - long long
+ *   value - long (not -1)
+ * Returns:
+ *   int - 0 on success, -1 if the table could not grow
+ */
+static int pageMapPutHashed(PageMap *map, long long page, long value) {
+    size_t mask;
+    size_t i;
+
+    /* keep the load factor at or below one half */
+    if (2 * (map->size + 1) > map->capacity && pageMapGrow(map) != 0) {
+        return -1;
     }
 
-    for (i = 0; i < PAGE_COUNT; i++) {
-        pageTable[i] = -1;
+    mask = map->capacity - 1;
+    for (i = pageHash(page, mask); map->keys[i] != -1; i = (i + 1) & mask) {
+        if (map->keys[i] == page) {
+            map->values[i] = value;
+            return 0;
+        }
     }
+    map->keys[i] = page;
+    map->values[i] = value;
+    map->size++;
+    return 0;
+}
+
+/*
+ * Arguments:
+ *   map  - PageMap *
+ *   page - long long (may be absent)
+ * Returns:
+ *   void
+ */
+static void pageMapRemoveHashed(PageMap *map, long long page) {
+    size_t mask;
+    size_t i;
+    size_t j;
 
-    for (i = 0; i < FRAME_COUNT; i++) {
-        framePage[i] = -1;
+    mask = map->capacity - 1;
+    for (i = pageHash(page, mask); map->keys[i] != page; i = (i + 1) & mask) {
+        if (map->keys[i] == -1) {
+            return;
+        }
     }
 
-    for (i = 0; i < TLB_COUNT; i++) {
-        tlb[i].page = -1;
-        tlb[i].frame = -1;
-        tlb[i].valid = 0;
+    /* shift later entries of the same probe run back into the hole */
+    for (j = (i + 1) & mask; map->keys[j] != -1; j = (j + 1) & mask) {
+        size_t home = pageHash(map->keys[j], mask);
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            map->keys[i] = map->keys[j];
+            map->values[i] = map->values[j];
+            i = j;
+        }
     }
+    map->keys[i] = -1;
+    map->size--;
+}
 
-    /* Step 2: read each logical address and get page number + offset */
-    while (fgets(line, sizeof(line), addressFile) != NULL) {
-        int logicalAddress;
-        int page;
-        int offset;
-        int frame;
-        int physicalAddress;
-        int oldPage;
-        signed char value;
+static inline int pageMapPut(PageMap *map, long long page, long value) {
+    if (map->flat != NULL) {
+        map->flat[page] = value;
+        return 0;
+    }
+    return pageMapPutHashed(map, page, value);
+}
 
-        logicalAddress = (int)strtol(line, NULL, 10) & 0xFFFF;
-        page = logicalAddress >> PAGE_BITS;
-        offset = logicalAddress & OFFSET_MASK;
+static inline void pageMapRemove(PageMap *map, long long page) {
+    if (map->flat != NULL) {
+        map->flat[page] = -1;
+        return;
+    }
+    pageMapRemoveHashed(map, page);
+}
 
-        /* Step 3: check TLB first, then check page table */
-        frame = findInTLB(tlb, page);
+/* TLB slot caching key, or -1 */
+static inline long tlbSlot(const TLB *tlb, long long key) {
+    if (tlb->slotIndex != NULL) {
+        return (long)tlb->slotIndex[key] - 1;
+    }
+    return pageMapGetHashed(&tlb->slotOfPage, key);
+}
 
-        if (frame != -1) {
-            hits++;
-        } else {
-            frame = pageTable[page];
+static inline void tlbSetSlot(TLB *tlb, long long key, int slot) {
+    if (tlb->slotIndex != NULL) {
+        tlb->slotIndex[key] = slot + 1;
+    } else if (pageMapPutHashed(&tlb->slotOfPage, key, slot) != 0) {
+        fprintf(stderr, "Memory allocation failed.\n");
+        exit(1);
+    }
+}
 
-            /* Step 4: if page is not in memory, handle page fault and load page into RAM */
-            if (frame == -1) {
-                faults++;
+static inline void tlbClearSlot(TLB *tlb, long long key) {
+    if (tlb->slotIndex != NULL) {
+        tlb->slotIndex[key] = 0;
+    } else {
+        pageMapRemoveHashed(&tlb->slotOfPage, key);
+    }
+}
 
-                frame = nextFrame;
-                oldPage = framePage[frame];
+/*
+ * Arguments:
+ *   tlb        - TLB * (zeroed)
+ *   count      - int (entries)
+ *   pageCount  - long long (pages in the logical space, a power of two)
+ *   asidCount  - int (address spaces)
+ * Returns:
+ *   int - 0 on success, -1 if allocation fails
+ */
+static int initTLB(TLB *tlb, int count, long long pageCount, int asidCount) {
+    /* tag arrays are padded so SIMD probes can always load 8 tags at once */
+    int padded = (count + 7) & ~7;
 
-                if (oldPage != -1) {
-                    pageTable[oldPage] = -1;
-                }
+    tlb->count = count;
+    tlb->asid = 0;
+    tlb->vpnBits = 0;
+    while ((1LL << tlb->vpnBits) < pageCount) {
+        tlb->vpnBits++;
+    }
+    /* zeroed items are invalid, so resetTLB has nothing to drop from the index */
+    tlb->items = calloc((size_t)count, sizeof(TLBItem));
+    tlb->tags.tags = malloc((size_t)padded * sizeof(int));
+    tlb->tags.valid = malloc((size_t)(padded + 63) / 64 * sizeof(unsigned long long));
+    tlb->tags.count = count;
 
-                memcpy(
-                    ram + frame * PAGE_SIZE,
-                    backingData + page * PAGE_SIZE,
-                    PAGE_SIZE
-                );
+    if (tlb->items == NULL || tlb->tags.tags == NULL || tlb->tags.valid == NULL) {
+        return -1;
+    }
+    if (pageCount * asidCount <= PAGEMAP_FLAT_MAX) {
+        tlb->slotIndex = calloc((size_t)(pageCount * asidCount), sizeof(int));
+        return tlb->slotIndex != NULL ? 0 : -1;
+    }
+    return pageMapInit(&tlb->slotOfPage, pageCount * asidCount);
+}
 
-                pageTable[page] = frame;
-                framePage[frame] = page;
-                nextFrame = (nextFrame + 1) % FRAME_COUNT;
+/* empties the TLB; pages still listed in the index are cleared one by one */
+static void resetTLB(TLB *tlb) {
+    int padded = (tlb->count + 7) & ~7;
+    int i;
 
-                if (oldPage != -1) {
-                    if (!replaceTLBEntry(tlb, oldPage, page, frame)) {
-                        if (findInTLB(tlb, page) == -1) {
-                            addToTLB(tlb, page, frame, &nextTLB);
-                        }
-                    }
-                } else {
-                    if (findInTLB(tlb, page) == -1) {
-                        addToTLB(tlb, page, frame, &nextTLB);
-                    }
-                }
-            } else {
-                if (findInTLB(tlb, page) == -1) {
-                    addToTLB(tlb, page, frame, &nextTLB);
-                }
-            }
+    for (i = 0; i < tlb->count; i++) {
+        if (tlb->items[i].entry & PTE_VALID) {
+            tlbClearSlot(tlb, tlb->items[i].key);
         }
+        tlb->items[i].key = -1;
+        tlb->items[i].entry = 0;
+        tlb->items[i].dirty = 0;
+    }
 
-        /* Step 5: build physical address, print value, and update counters */
-        physicalAddress = frame * PAGE_SIZE + offset;
-        value = ram[physicalAddress];
+    for (i = 0; i < padded; i++) {
+        tlb->tags.tags[i] = -1;
+    }
+    memset(tlb->tags.valid, 0, (size_t)(padded + 63) / 64 * sizeof(unsigned long long));
+    tlb->next = 0;
+}
+
+static void freeTLB(TLB *tlb) {
+    free(tlb->items);
+    free(tlb->slotIndex);
+    pageMapFree(&tlb->slotOfPage);
+    free(tlb->tags.tags);
+    free(tlb->tags.valid);
+}
+
+/*
+ * Arguments:
+ *   tlb  - TLB *
+ *   page - long long (in the current address space)
+ * Returns:
+ *   int - frame number if page is found in the TLB, otherwise -1
+ */
+int findInTLB(TLB *tlb, long long page) {
+    long long key = tlbKey(tlb, tlb->asid, page);
+    long slot = tlbProbe != NULL ? tlbProbe(&tlb->tags, (int)key)
+                                 : tlbSlot(tlb, key);
+
+    if (slot != -1) {
+        return (int)(tlb->items[slot].entry & PTE_FRAME_MASK);
+    }
+    return -1;
+}
+
+/*
+ * Arguments:
+ *   tlb   - TLB * (its FIFO position moves on)
+ *   page  - long long
+ *   frame - int
+ * Returns:
+ *   void
+ */
+void addToTLB(TLB *tlb, long long page, int frame) {
+    int pos = tlb->next;
+    long long key = tlbKey(tlb, tlb->asid, page);
+
+    /* the FIFO victim (if any) drops out of the index */
+    if (tlb->items[pos].entry & PTE_VALID) {
+        tlbClearSlot(tlb, tlb->items[pos].key);
+    }
+
+    tlbSetSlot(tlb, key, pos);
+    tlb->tags.tags[pos] = (int)key;
+    tlb->tags.valid[pos >> 6] |= 1ULL << (pos & 63);
+    tlb->items[pos].key = key;
+    tlb->items[pos].entry = (unsigned)frame | PTE_VALID;
+    tlb->items[pos].dirty = 0;
+    tlb->next = (pos + 1) % tlb->count;
+}
+
+/* 
+Arguments:
+- tlb: TLB *
+- oldAsid: int
+- oldPage: long long
+- newPage: long long (in the current address space)
+- frame: int
+
+Returns:
+- int: 1 if replaced, 0 otherwise
+*/
+int replaceTLBEntry(TLB *tlb, int oldAsid, long long oldPage, long long newPage, int frame) {
+    long long oldKey = tlbKey(tlb, oldAsid, oldPage);
+    long long newKey = tlbKey(tlb, tlb->asid, newPage);
+    long slot = tlbSlot(tlb, oldKey);
+
+    if (slot == -1) {
+        return 0;
+    }
+
+    tlbClearSlot(tlb, oldKey);
+    tlbSetSlot(tlb, newKey, (int)slot);
+    tlb->tags.tags[slot] = (int)newKey;
+    tlb->items[slot].key = newKey;
+    tlb->items[slot].entry = (unsigned)frame | PTE_VALID;
+    tlb->items[slot].dirty = 0;
+    return 1;
+}
 
-        printf("Virtual address: %d Physical address = %d Value=%d\n",
-               logicalAddress, physicalAddress, value);
+/*
+ * Arguments:
+ *   tlb  - TLB *
+ *   asid - int (address space of page)
+ *   page - long long
+ * Returns:
+ *   int - 1 if page was in the TLB and has been invalidated, 0 otherwise
+ */
+static int removeFromTLB(TLB *tlb, int asid, long long page) {
+    long long key = tlbKey(tlb, asid, page);
+    long slot = tlbSlot(tlb, key);
 
-        total++;
+    if (slot == -1) {
+        return 0;
     }
+    tlbClearSlot(tlb, key);
+    tlb->tags.tags[slot] = -1;
+    tlb->tags.valid[slot >> 6] &= ~(1ULL << (slot & 63));
+    tlb->items[slot].key = -1;
+    tlb->items[slot].entry = 0;
+    tlb->items[slot].dirty = 0;
+    return 1;
+}
 
-    /* Step 6: print final statistics and clean up */
-    printf("Total addresses = %d\n", total);
-    printf("Page_faults = %d\n", faults);
-    printf("TLB Hits = %d\n", hits);
+/*
+ * Arguments:
+ *   tlb  - TLB *
+ *   page - long long (in the TLB)
+ *   bits - unsigned (1, or the bit of one page for a superpage entry)
+ * Returns:
+ *   int - 1 if the entry was clean until now, 0 if it was already dirty
+ */
+static int markTLBDirty(TLB *tlb, long long page, unsigned bits) {
+    TLBItem *item = &tlb->items[tlbSlot(tlb, tlbKey(tlb, tlb->asid, page))];
 
-    munmap(backingData, LOGICAL_SIZE);
-    close(backingFile);
-    fclose(addressFile);
+    if ((item->dirty & bits) == bits) {
+        return 0;
+    }
+    item->dirty |= bits;
+    return 1;
+}
+
+/*
+ * Reads addresses from either a text trace (one decimal address per line,
+ * like addresses.txt) or a binary trace that is mmapped and decoded in
+ * batches.
+ */
+typedef struct {
+    FILE *text;
+    int fd;
+    const unsigned char *data;
+    size_t size;
+    size_t pos;
+    int width;
+    int access;    /* records carry an access byte */
+} TraceReader;
+
+static unsigned long long readLE(const unsigned char *p, int width) {
+    unsigned long long v = 0;
+    int i;
+    for (i = width - 1; i >= 0; i--) {
+        v = (v << 8) | p[i];
+    }
+    return v;
+}
+
+static void writeLE(unsigned char *p, unsigned long long v, int width) {
+    int i;
+    for (i = 0; i < width; i++) {
+        p[i] = (unsigned char)(v >> (8 * i));
+    }
+}
+
+/*
+ * Arguments:
+ *   r    - TraceReader * (filled in)
+ *   path - const char *
+ * Returns:
+ *   int - 0 on success, -1 on error (already reported)
+ */
+static int openTrace(TraceReader *r, const char *path) {
+    unsigned char header[TRACE_HEADER_SIZE];
+    struct stat st;
+    void *map;
+
+    memset(r, 0, sizeof(*r));
+    r->fd = open(path, O_RDONLY);
+    if (r->fd < 0) {
+        perror(path);
+        return -1;
+    }
+
+    /* anything without the magic is treated as a text trace */
+    if (fstat(r->fd, &st) != 0 ||
+        st.st_size < TRACE_HEADER_SIZE ||
+        read(r->fd, header, TRACE_HEADER_SIZE) != TRACE_HEADER_SIZE ||
+        memcmp(header, TRACE_MAGIC, 4) != 0) {
+        r->text = fdopen(r->fd, "r");
+        if (r->text == NULL) {
+            perror(path);
+            close(r->fd);
+            return -1;
+        }
+        rewind(r->text);
+        return 0;
+    }
+
+    r->width = (int)readLE(header + 6, 2);
+    if (readLE(header + 4, 2) != TRACE_VERSION ||
+        (r->width != 2 && r->width != 4 && r->width != 8)) {
+        fprintf(stderr, "%s: unsupported binary trace\n", path);
+        close(r->fd);
+        return -1;
+    }
+
+    r->access = (readLE(header + 8, 2) & TRACE_FLAG_ACCESS) != 0;
+
+    map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, r->fd, 0);
+    if (map == MAP_FAILED) {
+        perror("mmap");
+        close(r->fd);
+        return -1;
+    }
+    madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
 
+    r->data = map;
+    r->size = (size_t)st.st_size;
+    r->pos = TRACE_HEADER_SIZE;
     return 0;
-}
\ No newline at end of file
+}
+
+/*
+ * Parses one text trace line: an address, optionally followed by R (read,
+ * the default) or W (write). Negative addresses keep their low bits, as
+ * the original strtol and mask did.
+ * Arguments:
+ *   line - const char *
+ *   mask - unsigned long long (address bits to keep, without TRACE_WRITE_BIT)
+ * Returns:
+ *   unsigned long long - the address, with TRACE_WRITE_BIT for writes
+ */
+static unsigned long long parseTraceLine(const char *line, unsigned long long mask) {
+    char *end;
+    unsigned long long v = (unsigned long long)strtoll(line, &end, 10) & mask;
+
+    while (*end == ' ' || *end == '\t' || *end == ',') {
+        end++;
+    }
+    if (*end == 'W' || *end == 'w') {
+        v |= TRACE_WRITE_BIT;
+    }
+    return v;
+}
+
+/*
+ * Arguments:
+ *   r   - TraceReader *
+ *   out - unsigned long long array (at least max entries)
+ *   max - size_t
+ * Returns:
+ *   size_t - number of addresses stored in out (writes carry
+ *            TRACE_WRITE_BIT), 0 at end of trace
+ */
+static size_t readTraceBatch(TraceReader *r, unsigned long long *out, size_t max) {
+    size_t n = 0;
+
+    if (r->text != NULL) {
+        char line[64];
+        while (n < max && fgets(line, sizeof(line), r->text) != NULL) {
+            /* every replay masks to its logical bits afterwards */
+            out[n++] = parseTraceLine(line, ~TRACE_WRITE_BIT);
+        }
+        return n;
+    }
+
+    if (r->access) {
+        while (n < max && r->pos + r->width + 1 <= r->size) {
+            out[n] = readLE(r->data + r->pos, r->width);
+            if (r->data[r->pos + r->width] != 0) {
+                out[n] |= TRACE_WRITE_BIT;
+            }
+            n++;
+            r->pos += r->width + 1;
+        }
+        return n;
+    }
+
+    if (r->width == 2) {
+        while (n < max && r->pos + 2 <= r->size) {
+            out[n++] = r->data[r->pos] | ((unsigned int)r->data[r->pos + 1] << 8);
+            r->pos += 2;
+        }
+        return n;
+    }
+
+    while (n < max && r->pos + r->width <= r->size) {
+        out[n++] = readLE(r->data + r->pos, r->width);
+        r->pos += r->width;
+    }
+    return n;
+}
+
+static void closeTrace(TraceReader *r) {
+    if (r->text != NULL) {
+        fclose(r->text);
+    } else {
+        munmap((void *)r->data, r->size);
+        close(r->fd);
+    }
+}
+
+/*
+ * Arguments:
+ *   path - const char * (text or binary trace)
+ * Returns:
+ *   int - 1 if the trace has stores, 0 if not, -1 if it cannot be opened
+ */
+static int traceHasStores(const char *path) {
+    TraceReader r;
+    char line[64];
+    int stores;
+
+    if (openTrace(&r, path) != 0) {
+        return -1;
+    }
+    /* a text trace has to be read through; a binary one says so in its header */
+    stores = r.access;
+    while (r.text != NULL && !stores && fgets(line, sizeof(line), r.text) != NULL) {
+        stores = (parseTraceLine(line, ~TRACE_WRITE_BIT) & TRACE_WRITE_BIT) != 0;
+    }
+    closeTrace(&r);
+    return stores;
+}
+
+/*
+ * Converts a text trace into the binary format. Addresses are masked to
+ * the logical address space, as a replay would. Uses the narrowest of
+ * 2, 4 or 8 byte addresses that fits every address (or the width asked for).
+ * Access bytes are only written when the trace has writes.
+ * Arguments:
+ *   inPath  - const char * (text trace)
+ *   outPath - const char * (binary trace to write)
+ *   width   - int (2, 4, 8, or 0 to pick automatically)
+ *   geo     - const Geometry *
+ * Returns:
+ *   int - 0 on success, 1 on error
+ */
+static int convertTrace(const char *inPath, const char *outPath, int width, const Geometry *geo) {
+    unsigned long long logicalMask = (1ULL << geo->logicalBits) - 1;
+    FILE *in;
+    FILE *out;
+    char line[64];
+    unsigned char header[TRACE_HEADER_SIZE];
+    unsigned char buf[9];
+    unsigned long count = 0;
+    int autoWidth = width == 0;
+    int access = 0;
+
+    in = fopen(inPath, "r");
+    if (in == NULL) {
+        perror(inPath);
+        return 1;
+    }
+
+    if (autoWidth) {
+        width = 2;
+    }
+    while (fgets(line, sizeof(line), in) != NULL) {
+        unsigned long long v = parseTraceLine(line, logicalMask);
+        if (v & TRACE_WRITE_BIT) {
+            access = 1;
+            v &= ~TRACE_WRITE_BIT;
+        }
+        if (autoWidth && v > 0xFFFFFFFFULL) {
+            width = 8;
+        } else if (autoWidth && v > 0xFFFF && width < 4) {
+            width = 4;
+        }
+    }
+    rewind(in);
+
+    out = fopen(outPath, "wb");
+    if (out == NULL) {
+        perror(outPath);
+        fclose(in);
+        return 1;
+    }
+
+    memset(header, 0, sizeof(header));
+    memcpy(header, TRACE_MAGIC, 4);
+    writeLE(header + 4, TRACE_VERSION, 2);
+    writeLE(header + 6, (unsigned int)width, 2);
+    writeLE(header + 8, access ? TRACE_FLAG_ACCESS : 0, 2);
+    fwrite(header, 1, sizeof(header), out);
+
+    while (fgets(line, sizeof(line), in) != NULL) {
+        unsigned long long v = parseTraceLine(line, logicalMask);
+        writeLE(buf, v & ~TRACE_WRITE_BIT, width);
+        buf[width] = (v & TRACE_WRITE_BIT) != 0;
+        fwrite(buf, 1, (size_t)width + (size_t)access, out);
+        count++;
+    }
+
+    fclose(in);
+    if (fclose(out) != 0) {
+        perror(outPath);
+        return 1;
+    }
+
+    printf("Wrote %lu addresses (%d bytes each%s) to %s\n", count, width,
+           access ? ", with access bytes" : "", outPath);
+    return 0;
+}
+
+/*
+ * Synthetic traces (--generate and --bench). Each distribution draws
+ * page-sized units from the logical space of the geometry:
+ *   uniform - any address
+ *   zipf    - page of rank r with probability proportional to 1/r; ranks
+ *             are scattered over the space by an odd multiplier
+ *   seq     - every GEN_STEP bytes from 0, wrapping at the end
+ *   stride  - every `stride` bytes (4 pages by default)
+ *   loop    - seq over the first `workingSet` pages, again and again
+ *             (25% more pages than frames by default)
+ *   phase   - uniform over `workingSet` pages (half the frames by default)
+ *             that move to a random place every `phaseLength` accesses
+ */
+typedef struct {
+    int dist;                          /* index into distributions[] */
+    unsigned long long count;
+    unsigned long long seed;
+    unsigned long long stride;         /* bytes, 0 for the default */
+    long long workingSet;              /* pages, 0 for the default */
+    unsigned long long phaseLength;
+} TraceSpec;
+
+typedef struct {
+    const TraceSpec *spec;
+    unsigned long long rng;
+    unsigned long long mask;           /* logical size - 1 */
+    int pageBits;
+    unsigned long long cursor;
+    unsigned long long step;
+    unsigned long long limit;          /* loop: bytes before wrapping */
+    unsigned long long base;           /* phase: first address of the working set */
+    unsigned long long left;           /* phase: accesses until the next move */
+    double *zipfCdf;
+    long zipfCount;
+} Generator;
+
+/* splitmix64 */
+static unsigned long long nextRandom(unsigned long long *state) {
+    unsigned long long z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static unsigned long long genUniform(Generator *g) {
+    return nextRandom(&g->rng) & g->mask;
+}
+
+static unsigned long long genZipf(Generator *g) {
+    double u = (double)(nextRandom(&g->rng) >> 11) * (1.0 / 9007199254740992.0);
+    long lo = 0;
+    long hi = g->zipfCount - 1;
+    unsigned long long page;
+
+    /* first rank whose cumulative share exceeds u */
+    while (lo < hi) {
+        long mid = lo + (hi - lo) / 2;
+        if (g->zipfCdf[mid] > u) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    page = (unsigned long long)lo * 0x9E3779B97F4A7C15ULL;
+    return ((page << g->pageBits) & g->mask) | (nextRandom(&g->rng) & (((1ULL << g->pageBits) - 1)));
+}
+
+static unsigned long long genStep(Generator *g) {
+    unsigned long long address = g->cursor;
+
+    g->cursor = (g->cursor + g->step) & g->mask;
+    return address;
+}
+
+static unsigned long long genLoop(Generator *g) {
+    unsigned long long address = g->cursor;
+
+    g->cursor += GEN_STEP;
+    if (g->cursor >= g->limit) {
+        g->cursor = 0;
+    }
+    return address;
+}
+
+static unsigned long long genPhase(Generator *g) {
+    if (g->left == 0) {
+        g->base = nextRandom(&g->rng) & g->mask & ~((1ULL << g->pageBits) - 1);
+        g->left = g->spec->phaseLength;
+    }
+    g->left--;
+    return (g->base + nextRandom(&g->rng) % g->limit) & g->mask;
+}
+
+typedef struct {
+    const char *name;
+    unsigned long long (*next)(Generator *g);
+} Distribution;
+
+static const Distribution distributions[] = {
+    { "uniform", genUniform },
+    { "zipf", genZipf },
+    { "seq", genStep },
+    { "stride", genStep },
+    { "loop", genLoop },
+    { "phase", genPhase },
+};
+
+#define DISTRIBUTION_COUNT ((int)(sizeof(distributions) / sizeof(distributions[0])))
+
+/*
+ * Arguments:
+ *   g    - Generator * (filled in)
+ *   spec - const TraceSpec *
+ *   geo  - const Geometry *
+ * Returns:
+ *   int - 0 on success, -1 if allocation fails
+ */
+static int initGenerator(Generator *g, const TraceSpec *spec, const Geometry *geo) {
+    const char *name = distributions[spec->dist].name;
+    unsigned long long logicalSize = 1ULL << geo->logicalBits;
+    long long workingSet = spec->workingSet;
+    long i;
+
+    memset(g, 0, sizeof(*g));
+    g->spec = spec;
+    g->rng = spec->seed;
+    g->mask = logicalSize - 1;
+    g->pageBits = geo->pageBits;
+    g->step = strcmp(name, "stride") == 0
+                  ? (spec->stride > 0 ? spec->stride : 4ULL << geo->pageBits)
+                  : GEN_STEP;
+
+    if (workingSet <= 0) {
+        workingSet = strcmp(name, "loop") == 0 ? geo->frameCount + geo->frameCount / 4
+                                               : (geo->frameCount + 1) / 2;
+    }
+    if (workingSet > geo->pageCount) {
+        workingSet = geo->pageCount;
+    }
+    g->limit = (unsigned long long)workingSet << geo->pageBits;
+
+    if (strcmp(name, "zipf") == 0) {
+        double sum = 0.0;
+
+        g->zipfCount = geo->pageCount < ZIPF_MAX_PAGES ? (long)geo->pageCount : ZIPF_MAX_PAGES;
+        g->zipfCdf = malloc((size_t)g->zipfCount * sizeof(double));
+        if (g->zipfCdf == NULL) {
+            return -1;
+        }
+        for (i = 0; i < g->zipfCount; i++) {
+            sum += 1.0 / (double)(i + 1);
+            g->zipfCdf[i] = sum;
+        }
+        for (i = 0; i < g->zipfCount; i++) {
+            g->zipfCdf[i] /= sum;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Writes spec->count generated addresses as a binary trace, using the
+ * narrowest width that holds the logical space.
+ * Arguments:
+ *   out  - FILE * (opened for writing)
+ *   spec - const TraceSpec *
+ *   geo  - const Geometry *
+ * Returns:
+ *   int - 0 on success, -1 on error (already reported)
+ */
+static int writeGeneratedTrace(FILE *out, const TraceSpec *spec, const Geometry *geo) {
+    int width = geo->logicalBits <= 16 ? 2 : geo->logicalBits <= 32 ? 4 : 8;
+    unsigned char header[TRACE_HEADER_SIZE];
+    unsigned char *buf;
+    size_t len = 0;
+    unsigned long long n;
+    Generator g;
+
+    if (initGenerator(&g, spec, geo) != 0) {
+        fprintf(stderr, "Memory allocation failed.\n");
+        return -1;
+    }
+    buf = malloc(OUT_BUFFER_SIZE);
+    if (buf == NULL) {
+        fprintf(stderr, "Memory allocation failed.\n");
+        free(g.zipfCdf);
+        return -1;
+    }
+
+    memset(header, 0, sizeof(header));
+    memcpy(header, TRACE_MAGIC, 4);
+    writeLE(header + 4, TRACE_VERSION, 2);
+    writeLE(header + 6, (unsigned int)width, 2);
+    fwrite(header, 1, sizeof(header), out);
+
+    for (n = 0; n < spec->count; n++) {
+        if (len + (size_t)width > OUT_BUFFER_SIZE) {
+            fwrite(buf, 1, len, out);
+            len = 0;
+        }
+        writeLE(buf + len, distributions[spec->dist].next(&g), width);
+        len += (size_t)width;
+    }
+    fwrite(buf, 1, len, out);
+
+    free(buf);
+    free(g.zipfCdf);
+    if (ferror(out)) {
+        perror("write");
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Arguments:
+ *   path - const char * (binary trace to write)
+ *   spec - const TraceSpec *
+ *   geo  - const Geometry *
+ * Returns:
+ *   int - 0 on success, 1 on error
+ */
+static int generateTrace(const char *path, const TraceSpec *spec, const Geometry *geo) {
+    FILE *out = fopen(path, "wb");
+
+    if (out == NULL) {
+        perror(path);
+        return 1;
+    }
+    if (writeGeneratedTrace(out, spec, geo) != 0) {
+        fclose(out);
+        return 1;
+    }
+    if (fclose(out) != 0) {
+        perror(path);
+        return 1;
+    }
+    printf("Wrote %llu %s addresses to %s\n", spec->count, distributions[spec->dist].name, path);
+    return 0;
+}
+
+static char outBuf[OUT_BUFFER_SIZE];
+static size_t outLen = 0;
+
+/* writes everything buffered so far to stdout */
+static void flushOut(void) {
+    size_t done = 0;
+
+    while (done < outLen) {
+        ssize_t n = write(STDOUT_FILENO, outBuf + done, outLen - done);
+        if (n <= 0) {
+            perror("write");
+            exit(1);
+        }
+        done += (size_t)n;
+    }
+    outLen = 0;
+}
+
+static void outStr(const char *str, size_t len) {
+    memcpy(outBuf + outLen, str, len);
+    outLen += len;
+}
+
+/* same digits as printf("%llu") */
+static void outUnsigned(unsigned long long u) {
+    char digits[24];
+    int n = 0;
+
+    do {
+        digits[n++] = (char)('0' + u % 10);
+        u /= 10;
+    } while (u != 0);
+    while (n > 0) {
+        outBuf[outLen++] = digits[--n];
+    }
+}
+
+/* same digits as printf("%d") */
+static void outInt(int v) {
+    if (v < 0) {
+        outBuf[outLen++] = '-';
+        outUnsigned(0u - (unsigned int)v);
+    } else {
+        outUnsigned((unsigned int)v);
+    }
+}
+
+/*
+ * Arguments:
+ *   mode            - int (OUTPUT_FULL or OUTPUT_BINARY)
+ *   wide            - int (binary records with 64 bit addresses)
+ *   logicalAddress  - unsigned long long
+ *   physicalAddress - unsigned long
+ *   value           - int
+ * Returns:
+ *   void
+ */
+static void outTranslation(int mode, int wide, unsigned long long logicalAddress,
+                           unsigned long physicalAddress, int value) {
+    /* a full line is at most ~80 bytes */
+    if (outLen > OUT_BUFFER_SIZE - 128) {
+        flushOut();
+    }
+
+    if (mode == OUTPUT_FULL) {
+        outStr("Virtual address: ", 17);
+        outUnsigned(logicalAddress);
+        outStr(" Physical address = ", 20);
+        outUnsigned(physicalAddress);
+        outStr(" Value=", 7);
+        outInt(value);
+        outBuf[outLen++] = '\n';
+    } else if (!wide) {
+        writeLE((unsigned char *)outBuf + outLen, logicalAddress, 4);
+        writeLE((unsigned char *)outBuf + outLen + 4, physicalAddress, 4);
+        writeLE((unsigned char *)outBuf + outLen + 8, (unsigned int)value, 4);
+        outLen += OUT_RECORD_SIZE;
+    } else {
+        writeLE((unsigned char *)outBuf + outLen, logicalAddress, 8);
+        writeLE((unsigned char *)outBuf + outLen + 8, physicalAddress, 8);
+        writeLE((unsigned char *)outBuf + outLen + 16, (unsigned int)value, 4);
+        outLen += OUT_WIDE_RECORD_SIZE;
+    }
+}
+
+/*
+ * Page replacement. Free frames are handed out in order first; once
+ * memory is full the policy picks the victim. Every policy below is
+ * O(1) or O(log frames) per access.
+ */
+typedef struct {
+    int frameCount;
+
+    int hand;                /* FIFO and CLOCK */
+    unsigned char *ref;      /* CLOCK reference bits */
+
+    int *prev;               /* LRU list, most recent at head */
+    int *next;
+    int head;
+    int tail;
+
+    int *heap;               /* LFU and OPT: indexed min-heap of frames */
+    int *heapPos;
+    int heapSize;
+    long long *key;          /* ... local LRU: time of last use */
+    long long *tie;
+
+    const int *nextUse;      /* OPT: next trace position of the same page */
+
+    int *listHead;           /* local LRU: one list per process through prev/next */
+    int *listTail;
+    int listCount;
+    const int *owner;        /* local LRU: frame -> process */
+    int want;                /* local LRU: process victim() takes from */
+} PolicyState;
+
+typedef struct {
+    const char *name;
+    void (*reset)(PolicyState *ps);
+    void (*touch)(PolicyState *ps, int frame, long pos); /* resident page referenced at pos */
+    void (*load)(PolicyState *ps, int frame, long pos);  /* page just loaded into frame */
+    int (*victim)(PolicyState *ps);                      /* frame to evict, removed from the policy */
+} ReplacementPolicy;
+
+/*
+ * Arguments:
+ *   ps         - PolicyState * (zeroed)
+ *   frameCount - int
+ * Returns:
+ *   int - 0 on success, -1 if allocation fails
+ */
+static int initPolicyState(PolicyState *ps, int frameCount) {
+    size_t n = (size_t)frameCount;
+
+    ps->frameCount = frameCount;
+    ps->ref = malloc(n);
+    ps->prev = malloc(n * sizeof(int));
+    ps->next = malloc(n * sizeof(int));
+    ps->heap = malloc(n * sizeof(int));
+    ps->heapPos = malloc(n * sizeof(int));
+    ps->key = malloc(n * sizeof(long long));
+    ps->tie = malloc(n * sizeof(long long));
+
+    if (ps->ref == NULL || ps->prev == NULL || ps->next == NULL ||
+        ps->heap == NULL || ps->heapPos == NULL || ps->key == NULL || ps->tie == NULL) {
+        return -1;
+    }
+    return 0;
+}
+
+static void freePolicyState(PolicyState *ps) {
+    free(ps->listHead);
+    free(ps->listTail);
+    free(ps->ref);
+    free(ps->prev);
+    free(ps->next);
+    free(ps->heap);
+    free(ps->heapPos);
+    free(ps->key);
+    free(ps->tie);
+}
+
+/* FIFO: the original round-robin over frames */
+static void fifoReset(PolicyState *ps) {
+    ps->hand = 0;
+}
+
+static void fifoTouch(PolicyState *ps, int frame, long pos) {
+    (void)ps;
+    (void)frame;
+    (void)pos;
+}
+
+static int fifoVictim(PolicyState *ps) {
+    int frame = ps->hand;
+    ps->hand = (ps->hand + 1) % ps->frameCount;
+    return frame;
+}
+
+/* LRU: doubly linked list of frames, most recent at the head */
+static void lruReset(PolicyState *ps) {
+    ps->head = -1;
+    ps->tail = -1;
+}
+
+static void listUnlink(PolicyState *ps, int frame, int *head, int *tail) {
+    if (ps->prev[frame] != -1) {
+        ps->next[ps->prev[frame]] = ps->next[frame];
+    } else {
+        *head = ps->next[frame];
+    }
+    if (ps->next[frame] != -1) {
+        ps->prev[ps->next[frame]] = ps->prev[frame];
+    } else {
+        *tail = ps->prev[frame];
+    }
+}
+
+static void listPushFront(PolicyState *ps, int frame, int *head, int *tail) {
+    ps->prev[frame] = -1;
+    ps->next[frame] = *head;
+    if (*head != -1) {
+        ps->prev[*head] = frame;
+    } else {
+        *tail = frame;
+    }
+    *head = frame;
+}
+
+static void lruTouch(PolicyState *ps, int frame, long pos) {
+    (void)pos;
+    if (frame != ps->head) {
+        listUnlink(ps, frame, &ps->head, &ps->tail);
+        listPushFront(ps, frame, &ps->head, &ps->tail);
+    }
+}
+
+static void lruLoad(PolicyState *ps, int frame, long pos) {
+    (void)pos;
+    listPushFront(ps, frame, &ps->head, &ps->tail);
+}
+
+static int lruVictim(PolicyState *ps) {
+    int frame = ps->tail;
+    listUnlink(ps, frame, &ps->head, &ps->tail);
+    return frame;
+}
+
+/*
+ * Local LRU, used by the working-set and page-fault-frequency allocators:
+ * one LRU list per process, so a process can be trimmed from its least
+ * recently used end. pos is the owner's virtual time (its own accesses).
+ */
+static void localReset(PolicyState *ps) {
+    int i;
+
+    for (i = 0; i < ps->listCount; i++) {
+        ps->listHead[i] = -1;
+        ps->listTail[i] = -1;
+    }
+    ps->want = 0;
+}
+
+static void localTouch(PolicyState *ps, int frame, long pos) {
+    int p = ps->owner[frame];
+
+    ps->key[frame] = pos;
+    if (frame != ps->listHead[p]) {
+        listUnlink(ps, frame, &ps->listHead[p], &ps->listTail[p]);
+        listPushFront(ps, frame, &ps->listHead[p], &ps->listTail[p]);
+    }
+}
+
+static void localLoad(PolicyState *ps, int frame, long pos) {
+    int p = ps->owner[frame];
+
+    ps->key[frame] = pos;
+    listPushFront(ps, frame, &ps->listHead[p], &ps->listTail[p]);
+}
+
+static int localVictim(PolicyState *ps) {
+    int frame = ps->listTail[ps->want];
+    listUnlink(ps, frame, &ps->listHead[ps->want], &ps->listTail[ps->want]);
+    return frame;
+}
+
+/* CLOCK / second chance: one reference bit per frame and a sweeping hand */
+static void clockReset(PolicyState *ps) {
+    memset(ps->ref, 0, (size_t)ps->frameCount);
+    ps->hand = 0;
+}
+
+static void clockTouch(PolicyState *ps, int frame, long pos) {
+    (void)pos;
+    ps->ref[frame] = 1;
+}
+
+static int clockVictim(PolicyState *ps) {
+    int frame;
+
+    while (ps->ref[ps->hand]) {
+        ps->ref[ps->hand] = 0;
+        ps->hand = (ps->hand + 1) % ps->frameCount;
+    }
+    frame = ps->hand;
+    ps->hand = (ps->hand + 1) % ps->frameCount;
+    return frame;
+}
+
+/*
+ * Indexed binary min-heap over frames, ordered by (key, tie).
+ * LFU uses (use count, last use) and OPT uses (-next use, 0).
+ */
+static int heapLess(const PolicyState *ps, int a, int b) {
+    if (ps->key[a] != ps->key[b]) {
+        return ps->key[a] < ps->key[b];
+    }
+    return ps->tie[a] < ps->tie[b];
+}
+
+static void heapSwap(PolicyState *ps, int i, int j) {
+    int t = ps->heap[i];
+    ps->heap[i] = ps->heap[j];
+    ps->heap[j] = t;
+    ps->heapPos[ps->heap[i]] = i;
+    ps->heapPos[ps->heap[j]] = j;
+}
+
+/* restores heap order after key/tie of frame changed */
+static void heapFix(PolicyState *ps, int frame) {
+    int i = ps->heapPos[frame];
+
+    while (i > 0 && heapLess(ps, ps->heap[i], ps->heap[(i - 1) / 2])) {
+        heapSwap(ps, i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+    while (1) {
+        int smallest = i;
+        int l = 2 * i + 1;
+        int r = l + 1;
+
+        if (l < ps->heapSize && heapLess(ps, ps->heap[l], ps->heap[smallest])) {
+            smallest = l;
+        }
+        if (r < ps->heapSize && heapLess(ps, ps->heap[r], ps->heap[smallest])) {
+            smallest = r;
+        }
+        if (smallest == i) {
+            break;
+        }
+        heapSwap(ps, i, smallest);
+        i = smallest;
+    }
+}
+
+static void heapInsert(PolicyState *ps, int frame) {
+    ps->heap[ps->heapSize] = frame;
+    ps->heapPos[frame] = ps->heapSize;
+    ps->heapSize++;
+    heapFix(ps, frame);
+}
+
+static int heapPop(PolicyState *ps) {
+    int frame = ps->heap[0];
+
+    ps->heapSize--;
+    if (ps->heapSize > 0) {
+        heapSwap(ps, 0, ps->heapSize);
+        heapFix(ps, ps->heap[0]);
+    }
+    return frame;
+}
+
+static void heapReset(PolicyState *ps) {
+    ps->heapSize = 0;
+}
+
+/* LFU: fewest uses since load, ties go to the least recently used */
+static void lfuTouch(PolicyState *ps, int frame, long pos) {
+    ps->key[frame]++;
+    ps->tie[frame] = pos;
+    heapFix(ps, frame);
+}
+
+static void lfuLoad(PolicyState *ps, int frame, long pos) {
+    ps->key[frame] = 1;
+    ps->tie[frame] = pos;
+    heapInsert(ps, frame);
+}
+
+/*
+ * OPT (Belady): evict the page whose next use is furthest away.
+ * optNextUse[pos] is the next trace position touching the same page, or
+ * the trace length if there is none; built by buildNextUse before the run.
+ */
+static int *optNextUse = NULL;
+
+static void optTouch(PolicyState *ps, int frame, long pos) {
+    ps->key[frame] = -(long long)ps->nextUse[pos];
+    heapFix(ps, frame);
+}
+
+static void optLoad(PolicyState *ps, int frame, long pos) {
+    ps->key[frame] = -(long long)ps->nextUse[pos];
+    ps->tie[frame] = 0;
+    heapInsert(ps, frame);
+}
+
+static const ReplacementPolicy localPolicy = {
+    "LRU (local)", localReset, localTouch, localLoad, localVictim
+};
+
+static const ReplacementPolicy policies[POLICY_COUNT] = {
+    { "FIFO", fifoReset, fifoTouch, fifoTouch, fifoVictim },
+    { "LRU", lruReset, lruTouch, lruLoad, lruVictim },
+    { "CLOCK", clockReset, clockTouch, clockTouch, clockVictim },
+    { "LFU", heapReset, lfuTouch, lfuLoad, heapPop },
+    { "OPT", heapReset, optTouch, optLoad, heapPop }
+};
+
+/*
+ * Arguments:
+ *   name - const char * (case-insensitive policy name)
+ * Returns:
+ *   int - index into policies[], or -1 if unknown
+ */
+static int findPolicy(const char *name) {
+    int i;
+    for (i = 0; i < POLICY_COUNT; i++) {
+        if (strcasecmp(name, policies[i].name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Pre-pass for OPT: reads the whole trace once and fills optNextUse.
+ * Arguments:
+ *   tracePath - const char *
+ *   geo       - const Geometry *
+ * Returns:
+ *   int - 0 on success, -1 on error (already reported)
+ */
+static int buildNextUse(const char *tracePath, const Geometry *geo) {
+    TraceReader trace;
+    unsigned long long *batch;
+    long long *pages = NULL;
+    int *nextUse;
+    long capacity = 0;
+    PageMap lastUse;
+    long n = 0;
+    long pos;
+    unsigned long long logicalMask = (1ULL << geo->logicalBits) - 1;
+    size_t got;
+    size_t k;
+
+    if (openTrace(&trace, tracePath) != 0) {
+        return -1;
+    }
+
+    batch = malloc(TRACE_BATCH * sizeof(unsigned long long));
+    if (batch == NULL) {
+        fprintf(stderr, "Memory allocation failed.\n");
+        closeTrace(&trace);
+        return -1;
+    }
+
+    while ((got = readTraceBatch(&trace, batch, TRACE_BATCH)) > 0) {
+        if (n + (long)got > capacity) {
+            long long *grown;
+            capacity = capacity == 0 ? (1 << 20) : capacity * 2;
+            grown = realloc(pages, (size_t)capacity * sizeof(long long));
+            if (grown == NULL) {
+                fprintf(stderr, "Memory allocation failed.\n");
+                free(pages);
+                free(batch);
+                closeTrace(&trace);
+                return -1;
+            }
+            pages = grown;
+        }
+        for (k = 0; k < got; k++) {
+            pages[n++] = (long long)((batch[k] & logicalMask) >> geo->pageBits);
+        }
+    }
+    free(batch);
+    closeTrace(&trace);
+
+    nextUse = malloc((n > 0 ? (size_t)n : 1) * sizeof(int));
+    if (nextUse == NULL || pageMapInit(&lastUse, geo->pageCount) != 0) {
+        fprintf(stderr, "Memory allocation failed.\n");
+        free(nextUse);
+        free(pages);
+        return -1;
+    }
+
+    /* walking backwards, lastUse holds the next position of each page */
+    for (pos = n - 1; pos >= 0; pos--) {
+        long next = pageMapGet(&lastUse, pages[pos]);
+        nextUse[pos] = (int)(next == -1 ? n : next);
+        if (pageMapPut(&lastUse, pages[pos], pos) != 0) {
+            fprintf(stderr, "Memory allocation failed.\n");
+            pageMapFree(&lastUse);
+            free(nextUse);
+            free(pages);
+            return -1;
+        }
+    }
+
+    pageMapFree(&lastUse);
+    free(pages);
+    free(optNextUse);
+    optNextUse = nextUse;
+    return 0;
+}
+
+/*
+ * Page tables. All map a page number to a page table entry: the frame
+ * plus PTE_VALID and the other PTE bits (0 when not resident). Lookups set the
+ * referenced bit the way a hardware walk would and count the memory
+ * references they make, so the cost of a TLB miss can be compared across
+ * layouts.
+ *   flat     - one int per page, allocated up front (the original table)
+ *   2level   - radix tree with 2 levels, nodes allocated on first use
+ *   4level   - radix tree with 4 levels, nodes allocated on first use
+ *   inverted - one entry per frame, found through a hash of the page
+ */
+typedef struct PageTable PageTable;
+typedef struct Instrument Instrument;
+typedef struct Checkpoint Checkpoint;
+
+typedef struct {
+    const char *name;
+    int levels;                                       /* radix levels, 0 otherwise */
+    int (*init)(PageTable *pt);
+    void (*destroy)(PageTable *pt);
+    unsigned (*lookup)(PageTable *pt, long long page);
+    int (*map)(PageTable *pt, long long page, unsigned entry);
+    unsigned (*unmap)(PageTable *pt, long long page, int frame);     /* returns the old bits */
+    void (*update)(PageTable *pt, long long page, unsigned bits);    /* resident pages only */
+    unsigned (*peek)(PageTable *pt, long long page);                 /* lookup without refs or bits */
+} PageTableKind;
+
+struct PageTable {
+    const PageTableKind *kind;
+    int vpnBits;
+    int frameCount;
+    long long refs;          /* memory references made by lookups */
+    size_t bytes;            /* memory held by the table */
+
+    unsigned *flat;          /* flat */
+
+    void **root;             /* radix */
+    int levelShift[4];
+    int levelBits[4];
+
+    int *bucket;             /* inverted: hash bucket -> first frame */
+    int *chain;              /* inverted: frame -> next frame in bucket */
+    long long *owner;        /* inverted: frame -> page */
+    unsigned *bits;          /* inverted: frame -> PTE bits (PTE_VALID included) */
+    size_t bucketMask;
+};
+
+static int flatInit(PageTable *pt) {
+    size_t count = (size_t)1 << pt->vpnBits;
+
+    /* big tables come straight from zero pages, touched only where pages are mapped */
+    pt->bytes = count * sizeof(unsigned);
+    pt->flat = calloc(count, sizeof(unsigned));
+    return pt->flat != NULL ? 0 : -1;
+}
+
+static void flatDestroy(PageTable *pt) {
+    free(pt->flat);
+}
+
+static unsigned flatLookup(PageTable *pt, long long page) {
+    pt->refs++;
+    if (pt->flat[page] != 0) {
+        pt->flat[page] |= PTE_REFERENCED;
+    }
+    return pt->flat[page];
+}
+
+static unsigned flatPeek(PageTable *pt, long long page) {
+    return pt->flat[page];
+}
+
+static int flatMap(PageTable *pt, long long page, unsigned entry) {
+    pt->flat[page] = entry;
+    return 0;
+}
+
+static unsigned flatUnmap(PageTable *pt, long long page, int frame) {
+    unsigned bits = pt->flat[page] & PTE_BITS;
+
+    (void)frame;
+    pt->flat[page] = 0;
+    return bits;
+}
+
+static void flatUpdate(PageTable *pt, long long page, unsigned bits) {
+    pt->refs++;
+    pt->flat[page] |= bits;
+}
+
+/* index of page inside a level-`level` node */
+static inline size_t radixIndex(const PageTable *pt, long long page, int level) {
+    return (size_t)((unsigned long long)page >> pt->levelShift[level]) &
+           (((size_t)1 << pt->levelBits[level]) - 1);
+}
+
+/* interior nodes hold child pointers, the last level holds entries */
+static void *radixNewNode(PageTable *pt, int level) {
+    size_t fanout = (size_t)1 << pt->levelBits[level];
+    void *node;
+
+    if (level == pt->kind->levels - 1) {
+        node = calloc(fanout, sizeof(unsigned));
+        pt->bytes += fanout * sizeof(unsigned);
+    } else {
+        node = calloc(fanout, sizeof(void *));
+        pt->bytes += fanout * sizeof(void *);
+    }
+    return node;
+}
+
+static int radixInit(PageTable *pt) {
+    int levels = pt->kind->levels;
+    int shift = pt->vpnBits;
+    int i;
+
+    /* split the page number as evenly as possible, extra bits go to the top */
+    for (i = 0; i < levels; i++) {
+        pt->levelBits[i] = pt->vpnBits / levels + (i < pt->vpnBits % levels ? 1 : 0);
+        shift -= pt->levelBits[i];
+        pt->levelShift[i] = shift;
+    }
+
+    pt->bytes = 0;
+    pt->root = radixNewNode(pt, 0);
+    return pt->root != NULL ? 0 : -1;
+}
+
+static void radixFree(PageTable *pt, void **node, int level) {
+    size_t fanout = (size_t)1 << pt->levelBits[level];
+    size_t i;
+
+    if (level < pt->kind->levels - 1) {
+        for (i = 0; i < fanout; i++) {
+            if (node[i] != NULL) {
+                radixFree(pt, node[i], level + 1);
+            }
+        }
+    }
+    free(node);
+}
+
+static void radixDestroy(PageTable *pt) {
+    if (pt->root != NULL) {
+        radixFree(pt, pt->root, 0);
+    }
+}
+
+/* walks to the leaf entry of page (NULL if a node is missing), counting references */
+static unsigned *radixEntry(PageTable *pt, long long page, int countRefs) {
+    void **node = pt->root;
+    int level;
+
+    for (level = 0; level < pt->kind->levels - 1; level++) {
+        pt->refs += countRefs;
+        node = node[radixIndex(pt, page, level)];
+        if (node == NULL) {
+            return NULL;
+        }
+    }
+    pt->refs += countRefs;
+    return (unsigned *)node + radixIndex(pt, page, level);
+}
+
+static unsigned radixLookup(PageTable *pt, long long page) {
+    unsigned *entry = radixEntry(pt, page, 1);
+
+    if (entry == NULL) {
+        return 0;
+    }
+    if (*entry != 0) {
+        *entry |= PTE_REFERENCED;
+    }
+    return *entry;
+}
+
+static int radixMap(PageTable *pt, long long page, unsigned entry) {
+    void **node = pt->root;
+    int level;
+
+    for (level = 0; level < pt->kind->levels - 1; level++) {
+        size_t i = radixIndex(pt, page, level);
+        if (node[i] == NULL) {
+            node[i] = radixNewNode(pt, level + 1);
+            if (node[i] == NULL) {
+                return -1;
+            }
+        }
+        node = node[i];
+    }
+    ((unsigned *)node)[radixIndex(pt, page, level)] = entry;
+    return 0;
+}
+
+/* nodes are kept once allocated; only the leaf entry is cleared */
+static unsigned radixUnmap(PageTable *pt, long long page, int frame) {
+    unsigned *entry = radixEntry(pt, page, 0);
+    unsigned bits;
+
+    (void)frame;
+    if (entry == NULL) {
+        return 0;
+    }
+    bits = *entry & PTE_BITS;
+    *entry = 0;
+    return bits;
+}
+
+static void radixUpdate(PageTable *pt, long long page, unsigned bits) {
+    *radixEntry(pt, page, 1) |= bits;
+}
+
+static unsigned radixPeek(PageTable *pt, long long page) {
+    unsigned *entry = radixEntry(pt, page, 0);
+
+    return entry != NULL ? *entry : 0;
+}
+
+static int invertedInit(PageTable *pt) {
+    size_t buckets = 1;
+
+    while (buckets < (size_t)pt->frameCount) {
+        buckets *= 2;
+    }
+    pt->bucketMask = buckets - 1;
+    pt->bucket = malloc(buckets * sizeof(int));
+    pt->chain = malloc((size_t)pt->frameCount * sizeof(int));
+    pt->owner = malloc((size_t)pt->frameCount * sizeof(long long));
+    pt->bits = malloc((size_t)pt->frameCount * sizeof(unsigned));
+    pt->bytes = buckets * sizeof(int) +
+                (size_t)pt->frameCount * (sizeof(int) + sizeof(unsigned) + sizeof(long long));
+    if (pt->bucket == NULL || pt->chain == NULL || pt->owner == NULL || pt->bits == NULL) {
+        return -1;
+    }
+    memset(pt->bucket, -1, buckets * sizeof(int));
+    return 0;
+}
+
+static void invertedDestroy(PageTable *pt) {
+    free(pt->bucket);
+    free(pt->chain);
+    free(pt->owner);
+    free(pt->bits);
+}
+
+/* frame holding page, or -1, counting one reference per bucket and chain step */
+static int invertedFind(PageTable *pt, long long page, int countRefs) {
+    int frame;
+
+    pt->refs += countRefs;
+    for (frame = pt->bucket[pageHash(page, pt->bucketMask)]; frame != -1; frame = pt->chain[frame]) {
+        pt->refs += countRefs;
+        if (pt->owner[frame] == page) {
+            return frame;
+        }
+    }
+    return -1;
+}
+
+static unsigned invertedLookup(PageTable *pt, long long page) {
+    int frame = invertedFind(pt, page, 1);
+
+    if (frame == -1) {
+        return 0;
+    }
+    pt->bits[frame] |= PTE_REFERENCED;
+    return (unsigned)frame | pt->bits[frame];
+}
+
+static int invertedMap(PageTable *pt, long long page, unsigned entry) {
+    int frame = (int)(entry & PTE_FRAME_MASK);
+    size_t b = pageHash(page, pt->bucketMask);
+
+    pt->owner[frame] = page;
+    pt->bits[frame] = entry & ~PTE_FRAME_MASK;
+    pt->chain[frame] = pt->bucket[b];
+    pt->bucket[b] = frame;
+    return 0;
+}
+
+static unsigned invertedUnmap(PageTable *pt, long long page, int frame) {
+    int *link = &pt->bucket[pageHash(page, pt->bucketMask)];
+
+    while (*link != frame) {
+        link = &pt->chain[*link];
+    }
+    *link = pt->chain[frame];
+    return pt->bits[frame] & PTE_BITS;
+}
+
+static void invertedUpdate(PageTable *pt, long long page, unsigned bits) {
+    pt->bits[invertedFind(pt, page, 1)] |= bits;
+}
+
+static unsigned invertedPeek(PageTable *pt, long long page) {
+    int frame = invertedFind(pt, page, 0);
+
+    return frame != -1 ? (unsigned)frame | pt->bits[frame] : 0;
+}
+
+static const PageTableKind pageTableKinds[PAGE_TABLE_KIND_COUNT] = {
+    { "flat", 0, flatInit, flatDestroy, flatLookup, flatMap, flatUnmap, flatUpdate, flatPeek },
+    { "2level", 2, radixInit, radixDestroy, radixLookup, radixMap, radixUnmap, radixUpdate,
+      radixPeek },
+    { "4level", 4, radixInit, radixDestroy, radixLookup, radixMap, radixUnmap, radixUpdate,
+      radixPeek },
+    { "inverted", 0, invertedInit, invertedDestroy, invertedLookup, invertedMap, invertedUnmap,
+      invertedUpdate, invertedPeek }
+};
+
+/*
+ * Arguments:
+ *   name - const char *
+ * Returns:
+ *   int - index into pageTableKinds[], or -1 if unknown
+ */
+static int findPageTableKind(const char *name) {
+    int i;
+    for (i = 0; i < PAGE_TABLE_KIND_COUNT; i++) {
+        if (strcmp(name, pageTableKinds[i].name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Arguments:
+ *   pt   - PageTable * (filled in)
+ *   kind - const PageTableKind *
+ *   geo  - const Geometry *
+ * Returns:
+ *   int - 0 on success, -1 if allocation fails
+ */
+static int initPageTable(PageTable *pt, const PageTableKind *kind, const Geometry *geo) {
+    memset(pt, 0, sizeof(*pt));
+    pt->kind = kind;
+    pt->vpnBits = geo->logicalBits - geo->pageBits;
+    pt->frameCount = geo->frameCount;
+    return kind->init(pt);
+}
+
+/*
+ * Prefetchers guess the next misses. predict() sees the miss stream:
+ * every demand fault and the first use of every prefetched page. It
+ * learns from the miss and fills out[] with up to `degree` pages to load
+ * ahead (resident ones are skipped by the caller).
+ */
+typedef struct {
+    long long last;          /* last miss of the stream, -1 if the slot is free */
+    long long stride;
+    int confidence;          /* times in a row the stride repeated */
+} Stream;
+
+typedef struct {
+    int degree;
+    long long pageCount;
+    Stream streams[STREAM_COUNT];    /* stride */
+    int nextStream;
+    PageMap successor;               /* markov: page -> the miss that followed it */
+    long long lastMiss;
+} PrefetchState;
+
+typedef struct {
+    const char *name;
+    int (*reset)(PrefetchState *pf);                                 /* -1 if allocation fails */
+    int (*predict)(PrefetchState *pf, long long page, long long *out); /* returns the count */
+} Prefetcher;
+
+static int noReset(PrefetchState *pf) {
+    (void)pf;
+    return 0;
+}
+
+/* next-N: the pages right after the miss */
+static int nextPredict(PrefetchState *pf, long long page, long long *out) {
+    int i;
+
+    for (i = 0; i < pf->degree; i++) {
+        out[i] = page + 1 + i;
+    }
+    return pf->degree;
+}
+
+/*
+ * Stride: the trace has no instruction addresses, so streams are told
+ * apart by where they are. A miss continues the stream it is exactly one
+ * stride ahead of, or else the one whose last miss is nearest; once the
+ * same stride is seen twice the next `degree` strides are prefetched.
+ */
+static int strideReset(PrefetchState *pf) {
+    int i;
+
+    for (i = 0; i < STREAM_COUNT; i++) {
+        pf->streams[i].last = -1;
+    }
+    pf->nextStream = 0;
+    return 0;
+}
+
+static int stridePredict(PrefetchState *pf, long long page, long long *out) {
+    Stream *best = NULL;
+    long long bestGap = STREAM_WINDOW + 1;
+    long long stride;
+    int i;
+
+    for (i = 0; i < STREAM_COUNT && best == NULL; i++) {
+        Stream *st = &pf->streams[i];
+        if (st->last != -1 && st->stride != 0 && st->last + st->stride == page) {
+            best = st;
+        }
+    }
+    for (i = 0; i < STREAM_COUNT && best == NULL; i++) {
+        Stream *st = &pf->streams[i];
+        long long gap = page > st->last ? page - st->last : st->last - page;
+        if (st->last != -1 && gap < bestGap) {
+            bestGap = gap;
+            best = st;
+        }
+    }
+    if (best == NULL) {
+        best = &pf->streams[pf->nextStream];
+        pf->nextStream = (pf->nextStream + 1) % STREAM_COUNT;
+        best->last = page;
+        best->stride = 0;
+        best->confidence = 0;
+        return 0;
+    }
+
+    stride = page - best->last;
+    if (stride == 0) {
+        return 0;
+    }
+    if (stride == best->stride) {
+        best->confidence++;
+    } else {
+        best->stride = stride;
+        best->confidence = 0;
+    }
+    best->last = page;
+    if (best->confidence == 0) {
+        return 0;
+    }
+    for (i = 0; i < pf->degree; i++) {
+        out[i] = page + stride * (i + 1);
+    }
+    return pf->degree;
+}
+
+/* Markov: remembers which miss followed each page and follows that chain */
+static int markovReset(PrefetchState *pf) {
+    pageMapFree(&pf->successor);
+    pf->lastMiss = -1;
+    return pageMapInit(&pf->successor, pf->pageCount);
+}
+
+static int markovPredict(PrefetchState *pf, long long page, long long *out) {
+    long long next = page;
+    int n = 0;
+
+    if (pf->lastMiss != -1 && pf->lastMiss != page &&
+        pageMapPut(&pf->successor, pf->lastMiss, page) != 0) {
+        fprintf(stderr, "Memory allocation failed.\n");
+        exit(1);
+    }
+    pf->lastMiss = page;
+
+    while (n < pf->degree) {
+        next = pageMapGet(&pf->successor, next);
+        if (next == -1 || next == page) {
+            break;
+        }
+        out[n++] = next;
+    }
+    return n;
+}
+
+static const Prefetcher prefetchers[PREFETCHER_COUNT] = {
+    { "next", noReset, nextPredict },
+    { "stride", strideReset, stridePredict },
+    { "markov", markovReset, markovPredict }
+};
+
+/*
+ * Arguments:
+ *   name - const char *
+ * Returns:
+ *   int - index into prefetchers[], or -1 if unknown
+ */
+static int findPrefetcher(const char *name) {
+    int i;
+    for (i = 0; i < PREFETCHER_COUNT; i++) {
+        if (strcmp(name, prefetchers[i].name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+typedef struct {
+    long total;
+    long faults;
+    long hits;
+    unsigned long long bytesCopied;  /* backing store bytes copied into RAM */
+    long writes;
+    long writeBacks;                 /* dirty pages written back */
+    unsigned long long writeBackBytes;
+    long writeBackCalls;             /* pwritev calls after coalescing */
+    long contextSwitches;
+    long superpageHits;              /* hits in the superpage TLB (part of hits) */
+    long promotions;
+    long demotions;
+    long prefetches;                 /* pages loaded ahead of a fault */
+    long prefetchUseful;             /* ... and used while resident */
+    long prefetchWasted;             /* ... and evicted or left unused */
+    long prefetchCopies;             /* copies the prefetched pages took */
+    long releases;                   /* pages the allocator took back from the resident set */
+    long windows;
+    long thrashingWindows;           /* windows whose working sets did not fit in memory */
+} SimStats;
+
+/* a dirty page waiting to be written back, its bytes in slot `slot` of the queue */
+typedef struct {
+    long long page;
+    int slot;
+} WriteBack;
+
+/* everything one simulated machine owns */
+typedef struct {
+    Geometry geo;
+    const signed char *backingData;
+    size_t backingSize;
+    signed char *ram;
+    int zeroCopy;
+    const signed char **frameData;   /* frame -> its bytes, in ram or the backing store */
+    signed char *zeroPage;
+    int backingFd;
+    signed char *wbData;             /* WRITE_BACK_BATCH pages */
+    WriteBack wbQueue[WRITE_BACK_BATCH];
+    int wbCount;
+    PageTable *pageTables;           /* one per process */
+    int processCount;
+    int asid;                        /* process running now */
+    long long *framePage;
+    int *frameAsid;                  /* process owning the page in each frame */
+    TLB tlb;
+    int usedFrames;
+    const ReplacementPolicy *policy;
+    PolicyState ps;
+
+    /* superpages: frames come in aligned blocks, each reserved for one region */
+    int spShift;                     /* log2(geo.superpagePages) */
+    int blockCount;
+    int usedBlocks;                  /* blocks never reserved start here */
+    int *freeBlocks;                 /* emptied blocks that can be reserved again */
+    int freeBlockCount;
+    long long *blockRegion;          /* block -> region reserved in it, -1 if none */
+    int *blockResident;              /* pages of that region in place */
+    unsigned char *blockPromoted;
+    PageMap regionBlock;             /* region -> its reserved block */
+    int *freeFrames;                 /* left over from broken reservations, or released */
+    int freeCount;
+    TLB spTlb;                       /* region -> first frame of its block */
+
+    const Prefetcher *prefetcher;    /* NULL without prefetching */
+    PrefetchState pf;
+    unsigned char *framePrefetched;  /* loaded ahead and not used yet */
+    long long prefetchFrom;          /* miss to prefetch for before the next access, -1 if none */
+
+    int allocator;                   /* ALLOC_* */
+    long allocParam;                 /* working-set window or PFF interval */
+    int *resident;                   /* process -> frames it holds (ALLOC_WS, ALLOC_PFF) */
+    long *lastFault;                 /* process -> time of its last fault, in its accesses */
+
+#if INSTRUMENT
+    Instrument *ins;                 /* NULL unless --stats-out */
+#endif
+    Checkpoint *ck;                  /* NULL unless --checkpoint */
+} Vmm;
+
+static void destroyVmm(Vmm *vmm) {
+    int i;
+
+    if (vmm->ram != NULL) {
+        munmap(vmm->ram, (size_t)vmm->geo.physicalSize);
+    }
+    for (i = 0; vmm->pageTables != NULL && i < vmm->processCount; i++) {
+        if (vmm->pageTables[i].kind != NULL) {
+            vmm->pageTables[i].kind->destroy(&vmm->pageTables[i]);
+        }
+    }
+    free(vmm->pageTables);
+    free(vmm->framePage);
+    free(vmm->frameAsid);
+    free(vmm->frameData);
+    free(vmm->zeroPage);
+    free(vmm->wbData);
+    freeTLB(&vmm->tlb);
+    freePolicyState(&vmm->ps);
+    free(vmm->blockRegion);
+    free(vmm->freeBlocks);
+    free(vmm->blockResident);
+    free(vmm->blockPromoted);
+    pageMapFree(&vmm->regionBlock);
+    free(vmm->freeFrames);
+    freeTLB(&vmm->spTlb);
+    free(vmm->framePrefetched);
+    pageMapFree(&vmm->pf.successor);
+    free(vmm->resident);
+    free(vmm->lastFault);
+}
+
+/*
+ * Allocates the tables for one machine. RAM is an anonymous mapping, so
+ * frames cost nothing until they are first loaded. With zeroCopy, frames
+ * of whole backing store pages point straight into the mapping instead;
+ * a write copies the page into RAM first (copy-on-write). Every process
+ * gets its own page table of the given kind; frames and the TLB are shared.
+ * With superpages, frames are also split into aligned blocks that regions
+ * reserve, and a second TLB maps whole regions.
+ * Arguments:
+ *   vmm          - Vmm * (filled in)
+ *   geo          - const Geometry *
+ *   kind         - const PageTableKind *
+ *   processCount - int (address spaces)
+ *   backingFd    - int (dirty pages are written back through it)
+ *   backingData - const signed char * (mapped backing store)
+ *   backingSize - size_t (pages past the end read as zeros)
+ *   zeroCopy    - int
+ * Returns:
+ *   int - 0 on success, -1 on error (already reported)
+ */
+static int createVmm(Vmm *vmm, const Geometry *geo, const PageTableKind *kind, int processCount,
+                     int backingFd, const signed char *backingData, size_t backingSize,
+                     int zeroCopy) {
+    int i;
+
+    memset(vmm, 0, sizeof(*vmm));
+    vmm->geo = *geo;
+    vmm->prefetchFrom = -1;
+    vmm->backingFd = backingFd;
+    vmm->backingData = backingData;
+    vmm->backingSize = backingSize;
+    vmm->zeroCopy = zeroCopy;
+
+    vmm->ram = mmap(NULL, (size_t)geo->physicalSize, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (vmm->ram == MAP_FAILED) {
+        perror("mmap");
+        vmm->ram = NULL;
+        destroyVmm(vmm);
+        return -1;
+    }
+
+    vmm->pageTables = calloc((size_t)processCount, sizeof(PageTable));
+    if (vmm->pageTables == NULL) {
+        fprintf(stderr, "Memory allocation failed.\n");
+        destroyVmm(vmm);
+        return -1;
+    }
+    vmm->processCount = processCount;
+    for (i = 0; i < processCount; i++) {
+        if (initPageTable(&vmm->pageTables[i], kind, geo) != 0) {
+            fprintf(stderr, "Memory allocation failed.\n");
+            destroyVmm(vmm);
+            return -1;
+        }
+    }
+
+    vmm->framePage = malloc((size_t)geo->frameCount * sizeof(long long));
+    vmm->frameAsid = calloc((size_t)geo->frameCount, sizeof(int));
+    vmm->frameData = malloc((size_t)geo->frameCount * sizeof(signed char *));
+    vmm->zeroPage = calloc(1, geo->pageSize);
+    vmm->wbData = malloc((size_t)WRITE_BACK_BATCH * geo->pageSize);
+    if (vmm->framePage == NULL || vmm->frameAsid == NULL || vmm->frameData == NULL ||
+        vmm->zeroPage == NULL || vmm->wbData == NULL ||
+        initTLB(&vmm->tlb, geo->tlbCount, geo->pageCount, processCount) != 0 ||
+        initPolicyState(&vmm->ps, geo->frameCount) != 0) {
+        fprintf(stderr, "Memory allocation failed.\n");
+        destroyVmm(vmm);
+        return -1;
+    }
+
+    if (geo->superpagePages > 0) {
+        while ((1 << vmm->spShift) < geo->superpagePages) {
+            vmm->spShift++;
+        }
+        vmm->blockCount = geo->frameCount >> vmm->spShift;
+        vmm->blockRegion = malloc((size_t)vmm->blockCount * sizeof(long long));
+        vmm->freeBlocks = malloc((size_t)vmm->blockCount * sizeof(int));
+        vmm->blockResident = malloc((size_t)vmm->blockCount * sizeof(int));
+        vmm->blockPromoted = malloc((size_t)vmm->blockCount);
+        vmm->freeFrames = malloc((size_t)geo->frameCount * sizeof(int));
+        if (vmm->blockRegion == NULL || vmm->freeBlocks == NULL || vmm->blockResident == NULL ||
+            vmm->blockPromoted == NULL || vmm->freeFrames == NULL ||
+            pageMapInit(&vmm->regionBlock, geo->pageCount >> vmm->spShift) != 0 ||
+            initTLB(&vmm->spTlb, geo->superpageTlbCount, geo->pageCount >> vmm->spShift, 1) != 0) {
+            fprintf(stderr, "Memory allocation failed.\n");
+            destroyVmm(vmm);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Arguments:
+ *   vmm    - Vmm *
+ *   policy - const ReplacementPolicy * (ignored by the per-process allocators)
+ * Returns:
+ *   int - 0 on success, -1 if the page table could not be rebuilt
+ */
+static int resetVmm(Vmm *vmm, const ReplacementPolicy *policy) {
+    int frame;
+    int i;
+
+    /* the per-process allocators always replace locally */
+    if (vmm->allocator != ALLOC_GLOBAL) {
+        policy = &localPolicy;
+        memset(vmm->resident, 0, (size_t)vmm->processCount * sizeof(int));
+        memset(vmm->lastFault, 0, (size_t)vmm->processCount * sizeof(long));
+        vmm->freeCount = 0;
+    }
+
+    for (i = 0; i < vmm->processCount; i++) {
+        const PageTableKind *kind = vmm->pageTables[i].kind;
+
+        kind->destroy(&vmm->pageTables[i]);
+        if (initPageTable(&vmm->pageTables[i], kind, &vmm->geo) != 0) {
+            fprintf(stderr, "Memory allocation failed.\n");
+            vmm->pageTables[i].kind = NULL;
+            return -1;
+        }
+    }
+    memset(vmm->framePage, -1, (size_t)vmm->geo.frameCount * sizeof(long long));
+    memset(vmm->frameAsid, 0, (size_t)vmm->geo.frameCount * sizeof(int));
+    for (frame = 0; frame < vmm->geo.frameCount; frame++) {
+        vmm->frameData[frame] = vmm->ram + (size_t)frame * vmm->geo.pageSize;
+    }
+    resetTLB(&vmm->tlb);
+    vmm->tlb.asid = 0;
+    vmm->asid = 0;
+
+    vmm->wbCount = 0;
+    vmm->usedFrames = 0;
+    vmm->policy = policy;
+    vmm->ps.nextUse = optNextUse;
+    policy->reset(&vmm->ps);
+
+    if (vmm->geo.superpagePages > 0) {
+        for (i = 0; i < vmm->blockCount; i++) {
+            if (i < vmm->usedBlocks && vmm->blockRegion[i] != -1) {
+                pageMapRemove(&vmm->regionBlock, vmm->blockRegion[i]);
+            }
+            vmm->blockRegion[i] = -1;
+            vmm->blockResident[i] = 0;
+            vmm->blockPromoted[i] = 0;
+        }
+        /* frames past the last whole block can only be used one at a time */
+        vmm->freeCount = 0;
+        for (frame = vmm->geo.frameCount - 1; frame >= vmm->blockCount << vmm->spShift; frame--) {
+            vmm->freeFrames[vmm->freeCount++] = frame;
+        }
+        vmm->usedBlocks = 0;
+        vmm->freeBlockCount = 0;
+        resetTLB(&vmm->spTlb);
+    }
+
+    vmm->prefetchFrom = -1;
+    if (vmm->prefetcher != NULL) {
+        memset(vmm->framePrefetched, 0, (size_t)vmm->geo.frameCount);
+        if (vmm->prefetcher->reset(&vmm->pf) != 0) {
+            fprintf(stderr, "Memory allocation failed.\n");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Gives every process its own resident set, sized by the working-set or
+ * page-fault-frequency allocator, for the runs that follow.
+ * Arguments:
+ *   vmm       - Vmm *
+ *   allocator - int (ALLOC_WS or ALLOC_PFF)
+ *   param     - long (working-set window or PFF interval, in accesses of the process)
+ * Returns:
+ *   int - 0 on success, -1 if allocation fails (already reported)
+ */
+static int initAllocator(Vmm *vmm, int allocator, long param) {
+    int count = vmm->processCount;
+
+    vmm->resident = calloc((size_t)count, sizeof(int));
+    vmm->lastFault = calloc((size_t)count, sizeof(long));
+    vmm->freeFrames = malloc((size_t)vmm->geo.frameCount * sizeof(int));
+    vmm->ps.listHead = malloc((size_t)count * sizeof(int));
+    vmm->ps.listTail = malloc((size_t)count * sizeof(int));
+    if (vmm->resident == NULL || vmm->lastFault == NULL || vmm->freeFrames == NULL ||
+        vmm->ps.listHead == NULL || vmm->ps.listTail == NULL) {
+        fprintf(stderr, "Memory allocation failed.\n");
+        return -1;
+    }
+    vmm->ps.listCount = count;
+    vmm->ps.owner = vmm->frameAsid;
+    vmm->allocator = allocator;
+    vmm->allocParam = param;
+    return 0;
+}
+
+/*
+ * Turns on prefetching for the runs that follow.
+ * Arguments:
+ *   vmm        - Vmm *
+ *   prefetcher - const Prefetcher *
+ *   degree     - int (pages per prediction, at most MAX_PREFETCH_DEGREE)
+ * Returns:
+ *   int - 0 on success, -1 if allocation fails (already reported)
+ */
+static int initPrefetch(Vmm *vmm, const Prefetcher *prefetcher, int degree) {
+    vmm->framePrefetched = calloc((size_t)vmm->geo.frameCount, 1);
+    if (vmm->framePrefetched == NULL) {
+        fprintf(stderr, "Memory allocation failed.\n");
+        return -1;
+    }
+    vmm->prefetcher = prefetcher;
+    vmm->pf.degree = degree;
+    vmm->pf.pageCount = vmm->geo.pageCount;
+    return 0;
+}
+
+/*
+ * Makes frame hold page: copies it from the backing store, zero filling
+ * past its end, or in zero-copy mode points the frame at the mapping
+ * (whole pages) or the shared zero page (pages past the end).
+ * Returns:
+ *   size_t - bytes copied
+ */
+static inline size_t loadPage(Vmm *vmm, long long page, int frame, unsigned long pageSize) {
+    signed char *dst = vmm->ram + (size_t)frame * pageSize;
+    size_t start = (size_t)page * pageSize;
+    size_t have;
+
+    if (start + pageSize <= vmm->backingSize) {
+        if (vmm->zeroCopy) {
+            vmm->frameData[frame] = vmm->backingData + start;
+            return 0;
+        }
+        memcpy(dst, vmm->backingData + start, pageSize);
+        return pageSize;
+    }
+
+    have = start < vmm->backingSize ? vmm->backingSize - start : 0;
+    if (vmm->zeroCopy) {
+        if (have == 0) {
+            vmm->frameData[frame] = vmm->zeroPage;
+            return 0;
+        }
+        vmm->frameData[frame] = dst;
+    }
+    memcpy(dst, vmm->backingData + start, have);
+    memset(dst + have, 0, pageSize - have);
+    return have;
+}
+
+/* by page, and in queue order for the same page so the newest copy lands last */
+static int compareWriteBack(const void *a, const void *b) {
+    const WriteBack *wa = a;
+    const WriteBack *wb = b;
+
+    if (wa->page != wb->page) {
+        return (wa->page > wb->page) - (wa->page < wb->page);
+    }
+    return wa->slot - wb->slot;
+}
+
+/*
+ * Writes the queued pages back to the backing store. The queue is sorted
+ * by page and every run of consecutive pages goes out in one pwritev.
+ * Arguments:
+ *   vmm   - Vmm * (queue emptied)
+ *   stats - SimStats * (write-back counters to update)
+ * Returns:
+ *   void (exits if the backing store cannot be written)
+ */
+static void flushWriteBacks(Vmm *vmm, SimStats *stats) {
+    struct iovec iov[WRITE_BACK_BATCH];
+    size_t pageSize = vmm->geo.pageSize;
+    int first;
+    int i;
+
+    qsort(vmm->wbQueue, (size_t)vmm->wbCount, sizeof(WriteBack), compareWriteBack);
+
+    for (first = 0; first < vmm->wbCount; first = i) {
+        size_t start = (size_t)vmm->wbQueue[first].page * pageSize;
+        size_t len = 0;
+        int n = 0;
+        ssize_t done;
+
+        for (i = first; i < vmm->wbCount &&
+                        vmm->wbQueue[i].page == vmm->wbQueue[first].page + (i - first); i++) {
+            /* the file is never extended; the last page may be cut short */
+            size_t have = vmm->backingSize - (start + len);
+            iov[n].iov_base = vmm->wbData + (size_t)vmm->wbQueue[i].slot * pageSize;
+            iov[n].iov_len = have < pageSize ? have : pageSize;
+            len += iov[n].iov_len;
+            n++;
+        }
+
+        done = pwritev(vmm->backingFd, iov, n, (off_t)start);
+        if (done < 0 || (size_t)done != len) {
+            perror("write back");
+            exit(1);
+        }
+        stats->writeBackBytes += len;
+        stats->writeBackCalls++;
+    }
+    vmm->wbCount = 0;
+}
+
+/*
+ * Queues the dirty page in frame for write back. Pages past the end of
+ * the backing store have nowhere to go and are dropped.
+ * Arguments:
+ *   vmm   - Vmm *
+ *   page  - long long
+ *   frame - int
+ *   stats - SimStats *
+ * Returns:
+ *   void
+ */
+static void queueWriteBack(Vmm *vmm, long long page, int frame, SimStats *stats) {
+    size_t pageSize = vmm->geo.pageSize;
+    int slot = vmm->wbCount;
+
+    if ((size_t)page * pageSize >= vmm->backingSize) {
+        return;
+    }
+    memcpy(vmm->wbData + (size_t)slot * pageSize, vmm->frameData[frame], pageSize);
+    vmm->wbQueue[slot].page = page;
+    vmm->wbQueue[slot].slot = slot;
+    vmm->wbCount++;
+    stats->writeBacks++;
+    if (vmm->wbCount == WRITE_BACK_BATCH) {
+        flushWriteBacks(vmm, stats);
+    }
+}
+
+/* a mapped frame gets its own copy in RAM before it is written */
+static void copyOnWrite(Vmm *vmm, int frame, SimStats *stats) {
+    signed char *dst = vmm->ram + (size_t)frame * vmm->geo.pageSize;
+
+    if (vmm->frameData[frame] != dst) {
+        memcpy(dst, vmm->frameData[frame], vmm->geo.pageSize);
+        vmm->frameData[frame] = dst;
+        stats->bytesCopied += vmm->geo.pageSize;
+    }
+}
+
+/*
+ * Writes back every dirty page still resident, as an msync would at the
+ * end of the run. The page table is left empty.
+ * Arguments:
+ *   vmm   - Vmm *
+ *   stats - SimStats *
+ * Returns:
+ *   void
+ */
+static void syncVmm(Vmm *vmm, SimStats *stats) {
+    int frame;
+
+    for (frame = 0; frame < vmm->usedFrames; frame++) {
+        PageTable *pt = &vmm->pageTables[vmm->frameAsid[frame]];
+        long long page = vmm->framePage[frame];
+        if (page != -1 && (pt->kind->unmap(pt, page, frame) & PTE_DIRTY)) {
+            queueWriteBack(vmm, page, frame, stats);
+        }
+    }
+    flushWriteBacks(vmm, stats);
+}
+
+/*
+ * Ends the reservation of block (if it has one) because frame `taken` is
+ * given to another page: a promoted region is demoted and the empty
+ * slots go back to the free frames.
+ * Arguments:
+ *   vmm   - Vmm *
+ *   block - int (may be past the last whole block)
+ *   taken - int (frame in block being reused, or -1)
+ *   stats - SimStats *
+ * Returns:
+ *   void
+ */
+static void breakReservation(Vmm *vmm, int block, int taken, SimStats *stats) {
+    int first = block << vmm->spShift;
+    int frame;
+
+    if (block >= vmm->blockCount || vmm->blockRegion[block] == -1) {
+        return;
+    }
+    if (vmm->blockPromoted[block]) {
+        removeFromTLB(&vmm->spTlb, 0, vmm->blockRegion[block]);
+        vmm->blockPromoted[block] = 0;
+        stats->demotions++;
+    }
+    for (frame = first; frame < first + vmm->geo.superpagePages; frame++) {
+        if (frame != taken && vmm->framePage[frame] == -1) {
+            vmm->freeFrames[vmm->freeCount++] = frame;
+        }
+    }
+    pageMapRemove(&vmm->regionBlock, vmm->blockRegion[block]);
+    vmm->blockRegion[block] = -1;
+    vmm->blockResident[block] = 0;
+}
+
+/*
+ * Evicts the promoted region in block of frame, the policy's victim, for
+ * as long as the policy keeps choosing frames of that block: a region
+ * loaded at once usually leaves at once. The emptied block goes to the
+ * free blocks, so regions are still reserved and promoted after memory
+ * has filled up.
+ * Arguments:
+ *   vmm   - Vmm *
+ *   frame - int (in a promoted block, no longer known to the policy)
+ *   stats - SimStats *
+ * Returns:
+ *   int - -1 if the block is free now; otherwise the policy's next victim,
+ *         outside the block (its old page still mapped), the block's empty
+ *         frames having become free frames
+ */
+static int evictRegion(Vmm *vmm, int frame, SimStats *stats) {
+    PageTable *pt = &vmm->pageTables[vmm->asid];
+    int block = frame >> vmm->spShift;
+    int first = block << vmm->spShift;
+    int last = first + vmm->geo.superpagePages;
+    int i;
+
+    breakReservation(vmm, block, -1, stats);
+    while (frame >> vmm->spShift == block) {
+        long long page = vmm->framePage[frame];
+
+        if (page != -1) {
+            if (pt->kind->unmap(pt, page, frame) & PTE_DIRTY) {
+                queueWriteBack(vmm, page, frame, stats);
+            }
+            removeFromTLB(&vmm->tlb, vmm->asid, page);
+            vmm->framePage[frame] = -1;
+            if (vmm->framePrefetched != NULL && vmm->framePrefetched[frame]) {
+                vmm->framePrefetched[frame] = 0;
+                stats->prefetchWasted++;
+            }
+        }
+
+        for (i = first; i < last && vmm->framePage[i] == -1; i++) {
+        }
+        if (i == last) {
+            vmm->freeBlocks[vmm->freeBlockCount++] = block;
+            return -1;
+        }
+        frame = vmm->policy->victim(&vmm->ps);
+    }
+
+    for (i = first; i < last; i++) {
+        if (vmm->framePage[i] == -1) {
+            vmm->freeFrames[vmm->freeCount++] = i;
+        }
+    }
+    breakReservation(vmm, frame >> vmm->spShift, frame, stats);
+    return frame;
+}
+
+/*
+ * Picks the frame for a faulting page when superpages are on: its slot
+ * in the block reserved for its region, reserving a free or never used
+ * block if there is one; otherwise a free frame, and only then the
+ * policy's victim. A victim in a promoted block takes its whole region
+ * out (evictRegion), which may free a block to reserve.
+ * Arguments:
+ *   vmm   - Vmm *
+ *   page  - long long
+ *   stats - SimStats *
+ * Returns:
+ *   int - frame to load page into (its old page, if any, still mapped)
+ */
+static int superpageFrame(Vmm *vmm, long long page, SimStats *stats) {
+    long long region = page >> vmm->spShift;
+    long block = pageMapGet(&vmm->regionBlock, region);
+    int frame = -1;
+
+    if (block == -1 && vmm->freeBlockCount == 0 && vmm->usedBlocks == vmm->blockCount &&
+        vmm->freeCount == 0) {
+        /* FIFO and CLOCK may hand back an empty reserved slot; that breaks it too */
+        frame = vmm->policy->victim(&vmm->ps);
+        if ((frame >> vmm->spShift) < vmm->blockCount && vmm->blockPromoted[frame >> vmm->spShift]) {
+            frame = evictRegion(vmm, frame, stats);
+        } else {
+            breakReservation(vmm, frame >> vmm->spShift, frame, stats);
+        }
+    }
+
+    if (frame == -1) {
+        if (block == -1 && (vmm->freeBlockCount > 0 || vmm->usedBlocks < vmm->blockCount)) {
+            if (vmm->freeBlockCount > 0) {
+                block = vmm->freeBlocks[--vmm->freeBlockCount];
+            } else {
+                block = vmm->usedBlocks++;
+            }
+            vmm->blockRegion[block] = region;
+            if (pageMapPut(&vmm->regionBlock, region, block) != 0) {
+                fprintf(stderr, "Memory allocation failed.\n");
+                exit(1);
+            }
+        }
+
+        if (block != -1) {
+            frame = ((int)block << vmm->spShift) | (int)(page & (vmm->geo.superpagePages - 1));
+        } else {
+            frame = vmm->freeFrames[--vmm->freeCount];
+        }
+    }
+
+    if (frame >= vmm->usedFrames) {
+        vmm->usedFrames = frame + 1;
+    }
+    return frame;
+}
+
+/*
+ * Counts page, just loaded into frame, towards its region and promotes
+ * the region once every page sits in its reserved block: its base TLB
+ * entries are dropped and one superpage TLB entry covers them all.
+ * Returns:
+ *   int - 1 if the region was promoted
+ */
+static int promoteRegion(Vmm *vmm, long long page, int frame, SimStats *stats) {
+    int block = frame >> vmm->spShift;
+    long long region = page >> vmm->spShift;
+    int i;
+
+    if (block >= vmm->blockCount || vmm->blockRegion[block] != region ||
+        ++vmm->blockResident[block] < vmm->geo.superpagePages) {
+        return 0;
+    }
+    vmm->blockPromoted[block] = 1;
+    stats->promotions++;
+    for (i = 0; i < vmm->geo.superpagePages; i++) {
+        removeFromTLB(&vmm->tlb, vmm->asid, (region << vmm->spShift) + i);
+    }
+    addToTLB(&vmm->spTlb, region, block << vmm->spShift);
+    return 1;
+}
+
+/*
+ * Arguments:
+ *   vmm   - Vmm *
+ *   page  - long long (resident in frame)
+ *   frame - int
+ * Returns:
+ *   int - 1 if page is part of a promoted region (now in the superpage TLB), 0 otherwise
+ */
+static int fillSuperpageTLB(Vmm *vmm, long long page, int frame) {
+    int block = frame >> vmm->spShift;
+
+    if (block >= vmm->blockCount || !vmm->blockPromoted[block]) {
+        return 0;
+    }
+    if (findInTLB(&vmm->spTlb, page >> vmm->spShift) == -1) {
+        addToTLB(&vmm->spTlb, page >> vmm->spShift, block << vmm->spShift);
+    }
+    return 1;
+}
+
+/* first use of a prefetched page: it was useful, and it is a miss to prefetch for */
+static void usePrefetched(Vmm *vmm, long long page, int frame, SimStats *stats) {
+    vmm->framePrefetched[frame] = 0;
+    stats->prefetchUseful++;
+    vmm->prefetchFrom = page;
+}
+
+/*
+ * Superpage TLB lookup; a hit is counted like a base TLB hit.
+ * Returns:
+ *   int - frame of page, or -1 if its region is not in the superpage TLB
+ */
+static int superpageHit(Vmm *vmm, long long page, int write, long pos, SimStats *stats) {
+    long long region = page >> vmm->spShift;
+    int slot = (int)(page & (vmm->geo.superpagePages - 1));
+    int frame = findInTLB(&vmm->spTlb, region);
+
+    if (frame == -1) {
+        return -1;
+    }
+    frame += slot;
+    stats->hits++;
+    stats->superpageHits++;
+    vmm->policy->touch(&vmm->ps, frame, pos);
+    if (vmm->framePrefetched != NULL && vmm->framePrefetched[frame]) {
+        usePrefetched(vmm, page, frame, stats);
+    }
+
+    /* one dirty bit per page, so write-back stays per page */
+    if (write && markTLBDirty(&vmm->spTlb, region, 1U << slot)) {
+        PageTable *pt = &vmm->pageTables[vmm->asid];
+        pt->kind->update(pt, page, PTE_DIRTY);
+    }
+    return frame;
+}
+
+/*
+ * Takes back the pages of process p last used before `before` (its own
+ * time), oldest first; their frames become free.
+ */
+static void releaseBefore(Vmm *vmm, int p, long before, SimStats *stats) {
+    PolicyState *ps = &vmm->ps;
+    PageTable *pt = &vmm->pageTables[p];
+
+    while (ps->listTail[p] != -1 && ps->key[ps->listTail[p]] < before) {
+        int frame = ps->listTail[p];
+        long long page = vmm->framePage[frame];
+
+        listUnlink(ps, frame, &ps->listHead[p], &ps->listTail[p]);
+        if (pt->kind->unmap(pt, page, frame) & PTE_DIRTY) {
+            queueWriteBack(vmm, page, frame, stats);
+        }
+        removeFromTLB(&vmm->tlb, p, page);
+        vmm->framePage[frame] = -1;
+        vmm->resident[p]--;
+        vmm->freeFrames[vmm->freeCount++] = frame;
+        stats->releases++;
+    }
+}
+
+/*
+ * Trims the resident set of process p at its time `now`: with ALLOC_WS
+ * the pages unused for the window, with ALLOC_PFF (once more than the
+ * interval has passed since its last fault) every page unused since that
+ * fault. Done on each fault of p and at the end of every window.
+ */
+static void trimResidentSet(Vmm *vmm, int p, long now, SimStats *stats) {
+    if (vmm->allocator == ALLOC_WS) {
+        releaseBefore(vmm, p, now - vmm->allocParam + 1, stats);
+    } else if (now - vmm->lastFault[p] > vmm->allocParam) {
+        releaseBefore(vmm, p, vmm->lastFault[p], stats);
+    }
+}
+
+/*
+ * Frame for the running process under the working-set or PFF allocator.
+ * After trimming, its resident set grows into a free frame if there is
+ * one; otherwise the process replaces its own least recently used page,
+ * or if it holds none, one of the process holding the most.
+ * Arguments:
+ *   vmm   - Vmm *
+ *   now   - long (time of the running process, in its own accesses)
+ *   stats - SimStats *
+ * Returns:
+ *   int - the frame, its old page (if any) still mapped
+ */
+static int localFrame(Vmm *vmm, long now, SimStats *stats) {
+    int p = vmm->asid;
+    int from = p;
+    int frame;
+    int i;
+
+    trimResidentSet(vmm, p, now, stats);
+    vmm->lastFault[p] = now;
+
+    if (vmm->usedFrames < vmm->geo.frameCount) {
+        frame = vmm->usedFrames++;
+    } else if (vmm->freeCount > 0) {
+        frame = vmm->freeFrames[--vmm->freeCount];
+    } else {
+        if (vmm->resident[p] == 0) {
+            for (i = 0; i < vmm->processCount; i++) {
+                if (vmm->resident[i] > vmm->resident[from]) {
+                    from = i;
+                }
+            }
+        }
+        vmm->ps.want = from;
+        frame = vmm->policy->victim(&vmm->ps);
+        vmm->resident[from]--;
+    }
+    vmm->resident[p]++;
+    return frame;
+}
+
+/*
+ * Frame for a page about to be loaded: a never used frame while there
+ * are any (or the superpage or per-process placement), then the policy's
+ * victim. A prefetched page evicted before its first use counts as wasted.
+ * Returns:
+ *   int - the frame, its old page (if any) still mapped
+ */
+static inline int allocFrame(Vmm *vmm, long long page, long pos, SimStats *stats) {
+    int frame;
+
+    if (vmm->geo.superpagePages > 0) {
+        frame = superpageFrame(vmm, page, stats);
+    } else if (vmm->allocator != ALLOC_GLOBAL) {
+        frame = localFrame(vmm, pos, stats);
+    } else if (vmm->usedFrames < vmm->geo.frameCount) {
+        frame = vmm->usedFrames++;
+    } else {
+        frame = vmm->policy->victim(&vmm->ps);
+    }
+
+    if (vmm->framePrefetched != NULL && vmm->framePrefetched[frame]) {
+        vmm->framePrefetched[frame] = 0;
+        stats->prefetchWasted++;
+    }
+    return frame;
+}
+
+/*
+ * Loads the pages the prefetcher predicts from the pending miss, skipping
+ * resident ones. Frames are taken as on a fault; the copies are then done
+ * in one batch, where a run of consecutive pages going to consecutive
+ * frames is a single memcpy. Runs just before the next access, so the
+ * page that was just accessed is still in place when it is read.
+ * Arguments:
+ *   vmm   - Vmm * (prefetchFrom set)
+ *   pos   - long (position in the trace)
+ *   stats - SimStats *
+ * Returns:
+ *   void
+ */
+static void prefetch(Vmm *vmm, long pos, SimStats *stats) {
+    long long want[MAX_PREFETCH_DEGREE];
+    long long pages[MAX_PREFETCH_DEGREE];
+    int frames[MAX_PREFETCH_DEGREE];
+    PageTable *pt = &vmm->pageTables[vmm->asid];
+    size_t pageSize = vmm->geo.pageSize;
+    int count = vmm->prefetcher->predict(&vmm->pf, vmm->prefetchFrom, want);
+    int n = 0;
+    int i;
+    int j;
+
+    vmm->prefetchFrom = -1;
+
+    for (i = 0; i < count; i++) {
+        long long page = want[i];
+        long long oldPage;
+        int frame;
+
+        if (page < 0 || page >= vmm->geo.pageCount || pt->kind->peek(pt, page) != 0) {
+            continue;
+        }
+        frame = allocFrame(vmm, page, pos, stats);
+        oldPage = vmm->framePage[frame];
+        if (oldPage != -1) {
+            if (pt->kind->unmap(pt, oldPage, frame) & PTE_DIRTY) {
+                queueWriteBack(vmm, oldPage, frame, stats);
+            }
+            removeFromTLB(&vmm->tlb, vmm->asid, oldPage);
+        }
+        if (pt->kind->map(pt, page, (unsigned)frame | PTE_VALID | PTE_WRITABLE) != 0) {
+            fprintf(stderr, "Memory allocation failed.\n");
+            exit(1);
+        }
+        vmm->framePage[frame] = page;
+        vmm->frameAsid[frame] = vmm->asid;
+        vmm->framePrefetched[frame] = 1;
+        vmm->policy->load(&vmm->ps, frame, pos);
+        if (vmm->geo.superpagePages > 0) {
+            promoteRegion(vmm, page, frame, stats);
+        }
+        pages[n] = page;
+        frames[n] = frame;
+        n++;
+        stats->prefetches++;
+    }
+
+    for (i = 0; i < n; i = j) {
+        size_t start = (size_t)pages[i] * pageSize;
+
+        j = i + 1;
+        /* a tiny memory can hand a frame out twice in one batch */
+        if (vmm->framePage[frames[i]] != pages[i]) {
+            continue;
+        }
+        if (!vmm->zeroCopy) {
+            while (j < n && pages[j] == pages[j - 1] + 1 && frames[j] == frames[j - 1] + 1 &&
+                   vmm->framePage[frames[j]] == pages[j] &&
+                   start + (size_t)(j - i + 1) * pageSize <= vmm->backingSize) {
+                j++;
+            }
+        }
+        if (j - i > 1) {
+            memcpy(vmm->ram + (size_t)frames[i] * pageSize, vmm->backingData + start,
+                   (size_t)(j - i) * pageSize);
+            stats->bytesCopied += (size_t)(j - i) * pageSize;
+        } else {
+            stats->bytesCopied += loadPage(vmm, pages[i], frames[i], pageSize);
+        }
+        stats->prefetchCopies++;
+    }
+}
+
+/* prefetched pages never used by the end of the run were wasted too */
+static void finishPrefetch(Vmm *vmm, SimStats *stats) {
+    int frame;
+
+    for (frame = 0; frame < vmm->geo.frameCount; frame++) {
+        if (vmm->framePrefetched[frame]) {
+            vmm->framePrefetched[frame] = 0;
+            stats->prefetchWasted++;
+        }
+    }
+}
+
+/*
+ * Translates one logical address, loading the page on a fault. Always
+ * inlined so the default geometry gets a copy with constant page size.
+ * Arguments:
+ *   vmm            - Vmm *
+ *   logicalAddress - unsigned long long
+ *   write          - int (the access is a store)
+ *   pos            - long (position in the trace)
+ *   stats          - SimStats * (hit/fault counters to update)
+ *   pageBits       - int
+ *   pageSize       - unsigned long
+ * Returns:
+ *   unsigned long - physical address
+ */
+static inline __attribute__((always_inline))
+unsigned long translateWith(Vmm *vmm, unsigned long long logicalAddress, int write, long pos,
+                            SimStats *stats, int pageBits, unsigned long pageSize) {
+    long long page = (long long)(logicalAddress >> pageBits);
+    unsigned long offset = (unsigned long)logicalAddress & (pageSize - 1);
+    PageTable *pt = &vmm->pageTables[vmm->asid];
+    PageTable *oldPt;
+    int frame;
+    unsigned entry;
+    long long oldPage;
+    int oldAsid;
+    int superpage = 0;
+
+    if (vmm->prefetchFrom != -1) {
+        prefetch(vmm, pos, stats);
+    }
+
+    /* Step 3: check the TLBs first, then check page table */
+    frame = -1;
+    if (vmm->geo.superpagePages > 0) {
+        frame = superpageHit(vmm, page, write, pos, stats);
+    }
+
+    if (frame != -1) {
+        /* counted by superpageHit */
+    } else if ((frame = findInTLB(&vmm->tlb, page)) != -1) {
+        stats->hits++;
+        vmm->policy->touch(&vmm->ps, frame, pos);
+
+        /* the first store through a clean entry walks the table to set the dirty bit */
+        if (write && markTLBDirty(&vmm->tlb, page, 1)) {
+            pt->kind->update(pt, page, PTE_DIRTY);
+        }
+    } else {
+        if (pt->flat != NULL) {
+            pt->refs++;
+            entry = pt->flat[page];
+            if (entry != 0) {
+                pt->flat[page] = entry |= PTE_REFERENCED;
+            }
+        } else {
+            entry = pt->kind->lookup(pt, page);
+        }
+
+        /* Step 4: if page is not in memory, handle page fault and load page into RAM */
+        if (entry == 0) {
+            stats->faults++;
+
+            frame = allocFrame(vmm, page, pos, stats);
+            oldPage = vmm->framePage[frame];
+            oldAsid = vmm->frameAsid[frame];
+            oldPt = &vmm->pageTables[oldAsid];
+            entry = (unsigned)frame | PTE_VALID | PTE_WRITABLE | PTE_REFERENCED |
+                    (write ? PTE_DIRTY : 0);
+
+            /* the flat table is updated in place, the others through their kind */
+            if (pt->flat != NULL) {
+                if (oldPage != -1 && (oldPt->flat[oldPage] & PTE_DIRTY)) {
+                    queueWriteBack(vmm, oldPage, frame, stats);
+                }
+                if (oldPage != -1) {
+                    oldPt->flat[oldPage] = 0;
+                }
+                pt->flat[page] = entry;
+            } else {
+                if (oldPage != -1 && (oldPt->kind->unmap(oldPt, oldPage, frame) & PTE_DIRTY)) {
+                    queueWriteBack(vmm, oldPage, frame, stats);
+                }
+                if (pt->kind->map(pt, page, entry) != 0) {
+                    fprintf(stderr, "Memory allocation failed.\n");
+                    exit(1);
+                }
+            }
+
+            stats->bytesCopied += loadPage(vmm, page, frame, pageSize);
+            vmm->framePage[frame] = page;
+            vmm->frameAsid[frame] = vmm->asid;
+            vmm->policy->load(&vmm->ps, frame, pos);
+
+            if (oldPage != -1) {
+                if (!replaceTLBEntry(&vmm->tlb, oldAsid, oldPage, page, frame)) {
+                    if (findInTLB(&vmm->tlb, page) == -1) {
+                        addToTLB(&vmm->tlb, page, frame);
+                    }
+                }
+            } else {
+                if (findInTLB(&vmm->tlb, page) == -1) {
+                    addToTLB(&vmm->tlb, page, frame);
+                }
+            }
+            if (vmm->geo.superpagePages > 0) {
+                superpage = promoteRegion(vmm, page, frame, stats);
+            }
+            if (vmm->prefetcher != NULL) {
+                vmm->prefetchFrom = page;
+            }
+        } else {
+            frame = (int)(entry & PTE_FRAME_MASK);
+            vmm->policy->touch(&vmm->ps, frame, pos);
+            if (vmm->framePrefetched != NULL && vmm->framePrefetched[frame]) {
+                usePrefetched(vmm, page, frame, stats);
+            }
+            if (vmm->geo.superpagePages > 0 && fillSuperpageTLB(vmm, page, frame)) {
+                superpage = 1;
+            } else if (findInTLB(&vmm->tlb, page) == -1) {
+                addToTLB(&vmm->tlb, page, frame);
+            }
+            if (write && !(entry & PTE_DIRTY)) {
+                pt->kind->update(pt, page, PTE_DIRTY);
+                entry |= PTE_DIRTY;
+            }
+        }
+
+        if ((entry & PTE_DIRTY) && superpage) {
+            markTLBDirty(&vmm->spTlb, page >> vmm->spShift,
+                         1U << (page & (vmm->geo.superpagePages - 1)));
+        } else if (entry & PTE_DIRTY) {
+            markTLBDirty(&vmm->tlb, page, 1);
+        }
+    }
+
+    if (write) {
+        stats->writes++;
+        if (vmm->zeroCopy) {
+            copyOnWrite(vmm, frame, stats);
+        }
+    }
+
+    return (unsigned long)frame * pageSize + offset;
+}
+
+/* fast path for the default 256 B page geometry */
+static unsigned long translateDefault(Vmm *vmm, unsigned long long logicalAddress, int write,
+                                      long pos, SimStats *stats) {
+    return translateWith(vmm, logicalAddress, write, pos, stats, PAGE_BITS, PAGE_SIZE);
+}
+
+static unsigned long translateAny(Vmm *vmm, unsigned long long logicalAddress, int write,
+                                  long pos, SimStats *stats) {
+    return translateWith(vmm, logicalAddress, write, pos, stats,
+                         vmm->geo.pageBits, vmm->geo.pageSize);
+}
+
+static double nowNs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+#if INSTRUMENT
+/*
+ * Instrumentation of one run (--stats-out): hits and faults per window,
+ * a histogram of reuse distances (accesses since the page was last used,
+ * in powers of two), faults per page, and an HdrHistogram-style
+ * log-linear histogram of ns per translation. Reading the clock costs
+ * about as much as a translation, so one access in TIMING_SAMPLE is timed.
+ */
+#define TIMING_SAMPLE 64                                 /* a power of two */
+#define HDR_SUB_BITS 4                                   /* values kept within 1/16 */
+#define HDR_SUB_COUNT (1 << HDR_SUB_BITS)
+#define HDR_BUCKETS ((64 - HDR_SUB_BITS + 1) * HDR_SUB_COUNT)
+#define REUSE_BUCKETS 64
+
+struct Instrument {
+    long window;                     /* accesses per window */
+    long windowLeft;                 /* accesses until the window closes */
+    long *windowHits;
+    long *windowFaults;
+    long windowCount;
+    long windowCapacity;
+    long startHits;                  /* counters when the window began */
+    long startFaults;
+    PageMap lastUse;                 /* page -> position of its last access */
+    long reuse[REUSE_BUCKETS];       /* bucket b: distances from 2^b to 2^(b+1) - 1 */
+    long firstUses;
+    PageMap pageFaults;              /* page -> faults */
+    long ns[HDR_BUCKETS];
+    long timed;
+    long long maxNs;
+};
+
+/* bucket of v: exact below 2 * HDR_SUB_COUNT, then HDR_SUB_COUNT buckets per power of two */
+static int hdrIndex(unsigned long long v) {
+    int shift;
+
+    if (v < HDR_SUB_COUNT) {
+        return (int)v;
+    }
+    shift = 63 - __builtin_clzll(v) - HDR_SUB_BITS;
+    return (shift + 1) * HDR_SUB_COUNT + (int)((v >> shift) - HDR_SUB_COUNT);
+}
+
+/* smallest value in bucket i */
+static unsigned long long hdrLow(int i) {
+    int shift = i / HDR_SUB_COUNT - 1;
+
+    if (shift <= 0) {
+        return (unsigned long long)i;
+    }
+    return (unsigned long long)(i % HDR_SUB_COUNT + HDR_SUB_COUNT) << shift;
+}
+
+/*
+ * Arguments:
+ *   ins       - Instrument * (filled in)
+ *   pageCount - long long
+ *   window    - long (accesses per window)
+ * Returns:
+ *   int - 0 on success, -1 if allocation fails
+ */
+static int initInstrument(Instrument *ins, long long pageCount, long window) {
+    memset(ins, 0, sizeof(*ins));
+    ins->window = window;
+    ins->windowLeft = window;
+    if (pageMapInit(&ins->lastUse, pageCount) != 0 ||
+        pageMapInit(&ins->pageFaults, pageCount) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+static void freeInstrument(Instrument *ins) {
+    free(ins->windowHits);
+    free(ins->windowFaults);
+    pageMapFree(&ins->lastUse);
+    pageMapFree(&ins->pageFaults);
+}
+
+static void endStatsWindow(Instrument *ins, const SimStats *stats) {
+    if (ins->windowCount == ins->windowCapacity) {
+        long capacity = ins->windowCapacity > 0 ? ins->windowCapacity * 2 : 64;
+        long *hits = realloc(ins->windowHits, (size_t)capacity * sizeof(long));
+        long *faults;
+
+        if (hits == NULL) {
+            fprintf(stderr, "Memory allocation failed.\n");
+            exit(1);
+        }
+        ins->windowHits = hits;
+        faults = realloc(ins->windowFaults, (size_t)capacity * sizeof(long));
+        if (faults == NULL) {
+            fprintf(stderr, "Memory allocation failed.\n");
+            exit(1);
+        }
+        ins->windowFaults = faults;
+        ins->windowCapacity = capacity;
+    }
+    ins->windowHits[ins->windowCount] = stats->hits - ins->startHits;
+    ins->windowFaults[ins->windowCount] = stats->faults - ins->startFaults;
+    ins->windowCount++;
+    ins->startHits = stats->hits;
+    ins->startFaults = stats->faults;
+}
+
+/*
+ * translateDefault/translateAny plus the bookkeeping of one access.
+ * Returns:
+ *   unsigned long - physical address
+ */
+static unsigned long instrumentedTranslate(Vmm *vmm, unsigned long long logicalAddress, int write,
+                                           SimStats *stats) {
+    Instrument *ins = vmm->ins;
+    long pos = stats->total;
+    long long page = (long long)(logicalAddress >> vmm->geo.pageBits);
+    long faults = stats->faults;
+    long last = pageMapGet(&ins->lastUse, page);
+    int fast = vmm->geo.pageBits == PAGE_BITS;
+    unsigned long physicalAddress;
+
+    if ((pos & (TIMING_SAMPLE - 1)) == 0) {
+        double start = nowNs();
+        long long ns;
+
+        physicalAddress = fast ? translateDefault(vmm, logicalAddress, write, pos, stats)
+                               : translateAny(vmm, logicalAddress, write, pos, stats);
+        ns = (long long)(nowNs() - start);
+        ins->ns[hdrIndex((unsigned long long)ns)]++;
+        ins->timed++;
+        if (ns > ins->maxNs) {
+            ins->maxNs = ns;
+        }
+    } else {
+        physicalAddress = fast ? translateDefault(vmm, logicalAddress, write, pos, stats)
+                               : translateAny(vmm, logicalAddress, write, pos, stats);
+    }
+
+    if (last == -1) {
+        ins->firstUses++;
+    } else {
+        ins->reuse[63 - __builtin_clzll((unsigned long long)(pos - last))]++;
+    }
+    if (pageMapPut(&ins->lastUse, page, pos) != 0) {
+        fprintf(stderr, "Memory allocation failed.\n");
+        exit(1);
+    }
+    if (stats->faults != faults) {
+        long count = pageMapGet(&ins->pageFaults, page);
+        if (pageMapPut(&ins->pageFaults, page, count == -1 ? 1 : count + 1) != 0) {
+            fprintf(stderr, "Memory allocation failed.\n");
+            exit(1);
+        }
+    }
+    if (--ins->windowLeft == 0) {
+        endStatsWindow(ins, stats);
+        ins->windowLeft = ins->window;
+    }
+    return physicalAddress;
+}
+
+typedef struct {
+    long long page;
+    long faults;
+} PageFaults;
+
+static int comparePageFaults(const void *a, const void *b) {
+    const PageFaults *pa = a;
+    const PageFaults *pb = b;
+    return (pa->page > pb->page) - (pa->page < pb->page);
+}
+
+/*
+ * Arguments:
+ *   map   - const PageMap * (page -> faults)
+ *   count - long * (set to the number of pages)
+ * Returns:
+ *   PageFaults * - pages with faults by page number (free it), NULL if allocation fails
+ */
+static PageFaults *collectPageFaults(const PageMap *map, long *count) {
+    size_t slots = map->flat != NULL ? (size_t)map->keySpace : map->capacity;
+    PageFaults *out = malloc((map->flat != NULL ? slots : map->size + 1) * sizeof(PageFaults));
+    size_t i;
+
+    *count = 0;
+    if (out == NULL) {
+        return NULL;
+    }
+    for (i = 0; i < slots; i++) {
+        if (map->flat != NULL && map->flat[i] != -1) {
+            out[*count].page = (long long)i;
+            out[(*count)++].faults = map->flat[i];
+        } else if (map->flat == NULL && map->keys[i] != -1) {
+            out[*count].page = map->keys[i];
+            out[(*count)++].faults = map->values[i];
+        }
+    }
+    qsort(out, (size_t)*count, sizeof(PageFaults), comparePageFaults);
+    return out;
+}
+
+/* smallest bucket value with at least fraction q of the timed translations at or below it */
+static unsigned long long hdrPercentile(const Instrument *ins, double q) {
+    long target = (long)(q * ins->timed + 0.999999);
+    long seen = 0;
+    int i;
+
+    for (i = 0; i < HDR_BUCKETS; i++) {
+        seen += ins->ns[i];
+        if (seen >= target && seen > 0) {
+            return hdrLow(i);
+        }
+    }
+    return 0;
+}
+
+/*
+ * Writes everything collected to path, as CSV (section,key,value rows) or
+ * as one JSON object.
+ * Arguments:
+ *   ins   - Instrument * (the last partial window is closed)
+ *   stats - const SimStats * (of the finished run)
+ *   path  - const char *
+ *   json  - int
+ * Returns:
+ *   int - 0 on success, -1 on error (already reported)
+ */
+static int writeInstrument(Instrument *ins, const SimStats *stats, const char *path, int json) {
+    static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+    static const char *quantileNames[] = { "p50", "p90", "p99", "p999" };
+    FILE *out = fopen(path, "w");
+    PageFaults *pages;
+    long pageCount;
+    long i;
+    int q;
+
+    if (out == NULL) {
+        perror(path);
+        return -1;
+    }
+    if (stats->total % ins->window != 0) {
+        endStatsWindow(ins, stats);
+    }
+    pages = collectPageFaults(&ins->pageFaults, &pageCount);
+    if (pages == NULL) {
+        fprintf(stderr, "Memory allocation failed.\n");
+        fclose(out);
+        return -1;
+    }
+
+    if (!json) {
+        fprintf(out, "section,key,value\n");
+        for (i = 0; i < ins->windowCount; i++) {
+            long accesses = i + 1 < ins->windowCount ? ins->window
+                                                     : stats->total - i * ins->window;
+            fprintf(out, "window_hit_rate,%ld,%.4f\n", i, (double)ins->windowHits[i] / accesses);
+            fprintf(out, "window_fault_rate,%ld,%.4f\n", i,
+                    (double)ins->windowFaults[i] / accesses);
+        }
+        fprintf(out, "reuse_distance,first,%ld\n", ins->firstUses);
+        for (i = 0; i < REUSE_BUCKETS; i++) {
+            if (ins->reuse[i] > 0) {
+                fprintf(out, "reuse_distance,%llu,%ld\n", 1ULL << i, ins->reuse[i]);
+            }
+        }
+        for (i = 0; i < pageCount; i++) {
+            fprintf(out, "page_faults,%lld,%ld\n", pages[i].page, pages[i].faults);
+        }
+        for (i = 0; i < HDR_BUCKETS; i++) {
+            if (ins->ns[i] > 0) {
+                fprintf(out, "translate_ns,%llu,%ld\n", hdrLow((int)i), ins->ns[i]);
+            }
+        }
+        fprintf(out, "translate_ns_summary,sample_every,%d\n", TIMING_SAMPLE);
+        fprintf(out, "translate_ns_summary,samples,%ld\n", ins->timed);
+        for (q = 0; q < 4; q++) {
+            fprintf(out, "translate_ns_summary,%s,%llu\n", quantileNames[q],
+                    hdrPercentile(ins, quantiles[q]));
+        }
+        fprintf(out, "translate_ns_summary,max,%lld\n", ins->maxNs);
+    } else {
+        fprintf(out, "{\n  \"window\": %ld,\n  \"windows\": [", ins->window);
+        for (i = 0; i < ins->windowCount; i++) {
+            long accesses = i + 1 < ins->windowCount ? ins->window
+                                                     : stats->total - i * ins->window;
+            fprintf(out, "%s\n    {\"accesses\": %ld, \"hits\": %ld, \"faults\": %ld, "
+                         "\"hit_rate\": %.4f, \"fault_rate\": %.4f}",
+                    i > 0 ? "," : "", accesses, ins->windowHits[i], ins->windowFaults[i],
+                    (double)ins->windowHits[i] / accesses, (double)ins->windowFaults[i] / accesses);
+        }
+        fprintf(out, "\n  ],\n  \"reuse_distance\": {\"first\": %ld, \"buckets\": [",
+                ins->firstUses);
+        for (i = 0, q = 0; i < REUSE_BUCKETS; i++) {
+            if (ins->reuse[i] > 0) {
+                fprintf(out, "%s{\"min\": %llu, \"count\": %ld}", q++ > 0 ? ", " : "",
+                        1ULL << i, ins->reuse[i]);
+            }
+        }
+        fprintf(out, "]},\n  \"page_faults\": [");
+        for (i = 0; i < pageCount; i++) {
+            fprintf(out, "%s{\"page\": %lld, \"faults\": %ld}", i > 0 ? ", " : "",
+                    pages[i].page, pages[i].faults);
+        }
+        fprintf(out, "],\n  \"translate_ns\": {\"sample_every\": %d, \"samples\": %ld",
+                TIMING_SAMPLE, ins->timed);
+        for (q = 0; q < 4; q++) {
+            fprintf(out, ", \"%s\": %llu", quantileNames[q], hdrPercentile(ins, quantiles[q]));
+        }
+        fprintf(out, ", \"max\": %lld, \"buckets\": [", ins->maxNs);
+        for (i = 0, q = 0; i < HDR_BUCKETS; i++) {
+            if (ins->ns[i] > 0) {
+                fprintf(out, "%s{\"min\": %llu, \"count\": %ld}", q++ > 0 ? ", " : "",
+                        hdrLow((int)i), ins->ns[i]);
+            }
+        }
+        fprintf(out, "]}\n}\n");
+    }
+
+    free(pages);
+    if (fclose(out) != 0) {
+        perror(path);
+        return -1;
+    }
+    return 0;
+}
+#endif
+
+/*
+ * Checkpoints of a single run (--checkpoint FILE, --resume). A snapshot
+ * is the header below, then the frame table (page and page table entry
+ * of every frame, and where its bytes live), the policy arrays, the TLB
+ * entries, the write-back queue and the shape of the page table (radix
+ * leaves, or inverted hash chains), then the used part of RAM starting
+ * at an OS page boundary. Resuming copies the tables back, rebuilds the
+ * page table from its shape and the resident pages, the TLB index from
+ * its entries,
+ * and maps the RAM part of the file copy-on-write over RAM, so only the
+ * frames touched later are read. Snapshots are written to FILE.tmp and
+ * renamed, so FILE is always the last complete one. They hold raw
+ * structs: they are for the same build on the same machine.
+ */
+typedef struct {
+    char magic[4];
+    int version;
+    int headerSize;
+    int pageAlign;                   /* RAM starts at a multiple of this */
+    unsigned long pageSize;
+    int logicalBits;
+    unsigned long long physicalSize;
+    int tlbCount;
+    int policy;                      /* index into policies[] */
+    int kind;                        /* index into pageTableKinds[] */
+    int zeroCopy;
+    long long traceSize;
+    long long traceOffset;           /* where the next address starts */
+    SimStats stats;
+    int usedFrames;
+    int tlbNext;
+    int wbCount;
+    long long refs;                  /* page table memory references */
+    int hand;
+    int head;
+    int tail;
+    int heapSize;
+    long long shapeBytes;            /* page table shape after the write-back queue */
+    long long ramOffset;
+} CheckpointHeader;
+
+/* where the bytes of a frame live (zero copy frames may not be in RAM) */
+enum { FRAME_IN_RAM, FRAME_IN_BACKING, FRAME_ZERO };
+
+struct Checkpoint {
+    const char *path;
+    long every;                      /* accesses between snapshots */
+    long next;                       /* stats->total of the next snapshot */
+    long long traceSize;
+    int resumed;                     /* stats and traceOffset come from a snapshot */
+    SimStats stats;
+    long long traceOffset;
+};
+
+static long long traceOffset(const TraceReader *r) {
+    return r->text != NULL ? (long long)ftell(r->text) : (long long)r->pos;
+}
+
+static int seekTrace(TraceReader *r, long long offset) {
+    if (r->text != NULL) {
+        return fseek(r->text, (long)offset, SEEK_SET);
+    }
+    if (offset < TRACE_HEADER_SIZE || (size_t)offset > r->size) {
+        return -1;
+    }
+    r->pos = (size_t)offset;
+    return 0;
+}
+
+static long long checkpointRamOffset(const Vmm *vmm, long long shapeBytes, int pageAlign) {
+    size_t frames = (size_t)vmm->geo.frameCount;
+    long long tables = (long long)sizeof(CheckpointHeader) +
+                       (long long)frames * (sizeof(long long) + sizeof(unsigned) + 1) +
+                       (long long)frames * (1 + 4 * sizeof(int) + 2 * sizeof(long long)) +
+                       (long long)vmm->tlb.count * (long long)sizeof(TLBItem) +
+                       (long long)sizeof(vmm->wbQueue) + WRITE_BACK_BATCH * (long long)vmm->geo.pageSize +
+                       shapeBytes;
+
+    return (tables + pageAlign - 1) / pageAlign * pageAlign;
+}
+
+/*
+ * Radix nodes stay allocated after their pages leave, and walks stop at
+ * the first missing node, so the first page of every leaf is saved to
+ * give the resumed table the same nodes.
+ * Arguments:
+ *   pt     - PageTable * (radix)
+ *   node   - void ** (at level `level`)
+ *   level  - int
+ *   prefix - long long (page number bits above this node)
+ *   out    - FILE * (NULL to count only)
+ * Returns:
+ *   long long - leaves under node
+ */
+static long long writeRadixLeaves(PageTable *pt, void **node, int level, long long prefix, FILE *out) {
+    size_t fanout = (size_t)1 << pt->levelBits[level];
+    long long count = 0;
+    size_t i;
+
+    if (level == pt->kind->levels - 1) {
+        if (out != NULL) {
+            fwrite(&prefix, sizeof(prefix), 1, out);
+        }
+        return 1;
+    }
+    for (i = 0; i < fanout; i++) {
+        if (node[i] != NULL) {
+            count += writeRadixLeaves(pt, node[i], level + 1,
+                                      prefix | ((long long)i << pt->levelShift[level]), out);
+        }
+    }
+    return count;
+}
+
+/* bytes of the page table shape, written to out unless it is NULL */
+static long long writeTableShape(PageTable *pt, FILE *out) {
+    if (pt->kind->levels > 0) {
+        return writeRadixLeaves(pt, pt->root, 0, 0, out) * (long long)sizeof(long long);
+    }
+    if (pt->bucket != NULL) {
+        /* chain order decides how many entries a lookup walks */
+        if (out != NULL) {
+            fwrite(pt->bucket, sizeof(int), pt->bucketMask + 1, out);
+            fwrite(pt->chain, sizeof(int), (size_t)pt->frameCount, out);
+        }
+        return (long long)(pt->bucketMask + 1 + (size_t)pt->frameCount) * (long long)sizeof(int);
+    }
+    return 0;
+}
+
+/*
+ * Arguments:
+ *   vmm    - Vmm * (single process, between two accesses)
+ *   trace  - const TraceReader * (just past the last address replayed)
+ *   stats  - const SimStats *
+ * Returns:
+ *   int - 0 on success, -1 on error (already reported)
+ */
+static int writeCheckpoint(Vmm *vmm, const TraceReader *trace, const SimStats *stats) {
+    Checkpoint *ck = vmm->ck;
+    PageTable *pt = &vmm->pageTables[0];
+    PolicyState *ps = &vmm->ps;
+    size_t frames = (size_t)vmm->geo.frameCount;
+    size_t pageSize = vmm->geo.pageSize;
+    size_t pathLength = strlen(ck->path);
+    char *tmpPath = malloc(pathLength + 5);
+    unsigned *entries = malloc(frames * sizeof(unsigned));
+    unsigned char *where = malloc(frames);
+    CheckpointHeader h;
+    FILE *out;
+    size_t f;
+    long long pad;
+    int ok;
+
+    if (tmpPath == NULL || entries == NULL || where == NULL) {
+        fprintf(stderr, "Memory allocation failed.\n");
+        free(tmpPath);
+        free(entries);
+        free(where);
+        return -1;
+    }
+    memcpy(tmpPath, ck->path, pathLength);
+    memcpy(tmpPath + pathLength, ".tmp", 5);
+
+    for (f = 0; f < frames; f++) {
+        const signed char *data = vmm->frameData[f];
+
+        entries[f] = vmm->framePage[f] != -1 ? pt->kind->peek(pt, vmm->framePage[f]) : 0;
+        where[f] = data == vmm->zeroPage ? FRAME_ZERO
+                   : data == vmm->ram + f * pageSize ? FRAME_IN_RAM
+                                                     : FRAME_IN_BACKING;
+    }
+
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, CHECKPOINT_MAGIC, 4);
+    h.version = CHECKPOINT_VERSION;
+    h.headerSize = (int)sizeof(h);
+    h.pageAlign = (int)sysconf(_SC_PAGESIZE);
+    h.pageSize = vmm->geo.pageSize;
+    h.logicalBits = vmm->geo.logicalBits;
+    h.physicalSize = vmm->geo.physicalSize;
+    h.tlbCount = vmm->geo.tlbCount;
+    h.policy = (int)(vmm->policy - policies);
+    h.kind = (int)(pt->kind - pageTableKinds);
+    h.zeroCopy = vmm->zeroCopy;
+    h.traceSize = ck->traceSize;
+    h.traceOffset = traceOffset(trace);
+    h.stats = *stats;
+    h.usedFrames = vmm->usedFrames;
+    h.tlbNext = vmm->tlb.next;
+    h.wbCount = vmm->wbCount;
+    h.refs = pt->refs;
+    h.hand = ps->hand;
+    h.head = ps->head;
+    h.tail = ps->tail;
+    h.heapSize = ps->heapSize;
+    h.shapeBytes = writeTableShape(pt, NULL);
+    h.ramOffset = checkpointRamOffset(vmm, h.shapeBytes, h.pageAlign);
+
+    out = fopen(tmpPath, "wb");
+    if (out == NULL) {
+        perror(tmpPath);
+        free(tmpPath);
+        free(entries);
+        free(where);
+        return -1;
+    }
+    fwrite(&h, sizeof(h), 1, out);
+    fwrite(vmm->framePage, sizeof(long long), frames, out);
+    fwrite(entries, sizeof(unsigned), frames, out);
+    fwrite(where, 1, frames, out);
+    fwrite(ps->ref, 1, frames, out);
+    fwrite(ps->prev, sizeof(int), frames, out);
+    fwrite(ps->next, sizeof(int), frames, out);
+    fwrite(ps->heap, sizeof(int), frames, out);
+    fwrite(ps->heapPos, sizeof(int), frames, out);
+    fwrite(ps->key, sizeof(long long), frames, out);
+    fwrite(ps->tie, sizeof(long long), frames, out);
+    fwrite(vmm->tlb.items, sizeof(TLBItem), (size_t)vmm->tlb.count, out);
+    fwrite(vmm->wbQueue, sizeof(vmm->wbQueue), 1, out);
+    fwrite(vmm->wbData, pageSize, WRITE_BACK_BATCH, out);
+    writeTableShape(pt, out);
+    for (pad = ftell(out); pad < h.ramOffset; pad++) {
+        fputc(0, out);
+    }
+    fwrite(vmm->ram, pageSize, (size_t)vmm->usedFrames, out);
+
+    ok = fflush(out) == 0 && !ferror(out) && fsync(fileno(out)) == 0;
+    ok = fclose(out) == 0 && ok;
+    if (!ok || rename(tmpPath, ck->path) != 0) {
+        perror(ck->path);
+        unlink(tmpPath);
+        ok = 0;
+    }
+
+    free(tmpPath);
+    free(entries);
+    free(where);
+    return ok ? 0 : -1;
+}
+
+/*
+ * Loads ck->path into a freshly reset single-process vmm.
+ * Arguments:
+ *   vmm - Vmm * (reset with the policy the snapshot was taken with)
+ * Returns:
+ *   int - 1 if resumed, 0 if there is no snapshot yet, -1 on error
+ *         (already reported)
+ */
+static int readCheckpoint(Vmm *vmm) {
+    Checkpoint *ck = vmm->ck;
+    PageTable *pt = &vmm->pageTables[0];
+    PolicyState *ps = &vmm->ps;
+    size_t frames = (size_t)vmm->geo.frameCount;
+    size_t pageSize = vmm->geo.pageSize;
+    const unsigned char *p;
+    const unsigned *entries;
+    const unsigned char *where;
+    CheckpointHeader h;
+    struct stat st;
+    size_t ramBytes;
+    void *map;
+    int fd;
+    int i;
+
+    fd = open(ck->path, O_RDONLY);
+    if (fd < 0) {
+        return 0;
+    }
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(h)) {
+        fprintf(stderr, "%s: not a checkpoint\n", ck->path);
+        close(fd);
+        return -1;
+    }
+    map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        perror("mmap");
+        close(fd);
+        return -1;
+    }
+    memcpy(&h, map, sizeof(h));
+
+    if (memcmp(h.magic, CHECKPOINT_MAGIC, 4) != 0 || h.version != CHECKPOINT_VERSION ||
+        h.headerSize != (int)sizeof(h) || h.pageAlign != (int)sysconf(_SC_PAGESIZE) ||
+        h.ramOffset != checkpointRamOffset(vmm, h.shapeBytes, h.pageAlign) ||
+        (unsigned long long)st.st_size < (unsigned long long)h.ramOffset + (size_t)h.usedFrames * pageSize) {
+        fprintf(stderr, "%s: not a checkpoint of this build\n", ck->path);
+        munmap(map, (size_t)st.st_size);
+        close(fd);
+        return -1;
+    }
+    if (h.pageSize != vmm->geo.pageSize || h.logicalBits != vmm->geo.logicalBits ||
+        h.physicalSize != vmm->geo.physicalSize || h.tlbCount != vmm->geo.tlbCount ||
+        h.policy != (int)(vmm->policy - policies) || h.kind != (int)(pt->kind - pageTableKinds) ||
+        h.zeroCopy != vmm->zeroCopy || h.traceSize != ck->traceSize) {
+        fprintf(stderr, "%s was taken with another trace, geometry, policy, page table or --frames.\n",
+                ck->path);
+        munmap(map, (size_t)st.st_size);
+        close(fd);
+        return -1;
+    }
+
+    p = (const unsigned char *)map + sizeof(h);
+    memcpy(vmm->framePage, p, frames * sizeof(long long));
+    p += frames * sizeof(long long);
+    entries = (const unsigned *)p;
+    p += frames * sizeof(unsigned);
+    where = p;
+    p += frames;
+    memcpy(ps->ref, p, frames);
+    p += frames;
+    memcpy(ps->prev, p, frames * sizeof(int));
+    p += frames * sizeof(int);
+    memcpy(ps->next, p, frames * sizeof(int));
+    p += frames * sizeof(int);
+    memcpy(ps->heap, p, frames * sizeof(int));
+    p += frames * sizeof(int);
+    memcpy(ps->heapPos, p, frames * sizeof(int));
+    p += frames * sizeof(int);
+    memcpy(ps->key, p, frames * sizeof(long long));
+    p += frames * sizeof(long long);
+    memcpy(ps->tie, p, frames * sizeof(long long));
+    p += frames * sizeof(long long);
+    ps->hand = h.hand;
+    ps->head = h.head;
+    ps->tail = h.tail;
+    ps->heapSize = h.heapSize;
+
+    /* the TLB index and probe tags follow the entries */
+    memcpy(vmm->tlb.items, p, (size_t)vmm->tlb.count * sizeof(TLBItem));
+    p += (size_t)vmm->tlb.count * sizeof(TLBItem);
+    for (i = 0; i < vmm->tlb.count; i++) {
+        if (vmm->tlb.items[i].entry & PTE_VALID) {
+            tlbSetSlot(&vmm->tlb, vmm->tlb.items[i].key, i);
+            vmm->tlb.tags.tags[i] = (int)vmm->tlb.items[i].key;
+            vmm->tlb.tags.valid[i >> 6] |= 1ULL << (i & 63);
+        }
+    }
+    vmm->tlb.next = h.tlbNext;
+
+    memcpy(vmm->wbQueue, p, sizeof(vmm->wbQueue));
+    p += sizeof(vmm->wbQueue);
+    memcpy(vmm->wbData, p, WRITE_BACK_BATCH * pageSize);
+    p += WRITE_BACK_BATCH * pageSize;
+    vmm->wbCount = h.wbCount;
+
+    /* the page table is rebuilt from its shape and the resident pages */
+    if (pt->kind->levels > 0) {
+        const long long *leaves = (const long long *)p;
+        long long k;
+
+        for (k = 0; k < h.shapeBytes / (long long)sizeof(long long); k++) {
+            if (pt->kind->map(pt, leaves[k], 0) != 0) {
+                fprintf(stderr, "Memory allocation failed.\n");
+                munmap(map, (size_t)st.st_size);
+                close(fd);
+                return -1;
+            }
+        }
+    }
+    for (i = 0; i < (int)frames; i++) {
+        long long page = vmm->framePage[i];
+
+        if (page != -1 && pt->kind->map(pt, page, entries[i]) != 0) {
+            fprintf(stderr, "Memory allocation failed.\n");
+            munmap(map, (size_t)st.st_size);
+            close(fd);
+            return -1;
+        }
+        vmm->frameData[i] = where[i] == FRAME_ZERO         ? vmm->zeroPage
+                            : where[i] == FRAME_IN_BACKING ? vmm->backingData + (size_t)page * pageSize
+                                                           : vmm->ram + (size_t)i * pageSize;
+    }
+    if (pt->bucket != NULL) {
+        memcpy(pt->bucket, p, (pt->bucketMask + 1) * sizeof(int));
+        memcpy(pt->chain, p + (pt->bucketMask + 1) * sizeof(int), frames * sizeof(int));
+    }
+    pt->refs = h.refs;
+    vmm->usedFrames = h.usedFrames;
+
+    /* RAM: the file's pages stand in for the frames until they are written */
+    ramBytes = (size_t)h.usedFrames * pageSize;
+    if (ramBytes > 0) {
+        size_t mapped = (ramBytes + (size_t)h.pageAlign - 1) / (size_t)h.pageAlign * (size_t)h.pageAlign;
+        if (mmap(vmm->ram, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd,
+                 (off_t)h.ramOffset) == MAP_FAILED) {
+            memcpy(vmm->ram, (const unsigned char *)map + h.ramOffset, ramBytes);
+        }
+    }
+
+    ck->stats = h.stats;
+    ck->traceOffset = h.traceOffset;
+    ck->resumed = 1;
+    munmap(map, (size_t)st.st_size);
+    close(fd);
+    return 1;
+}
+
+/*
+ * Replays decoded addresses through vmm, continuing from stats->total.
+ * Arguments:
+ *   vmm        - Vmm *
+ *   batch      - const unsigned long long * (TRACE_WRITE_BIT marks writes)
+ *   n          - size_t
+ *   outputMode - int (OUTPUT_*)
+ *   stats      - SimStats * (updated)
+ * Returns:
+ *   void
+ */
+static void replayBatch(Vmm *vmm, const unsigned long long *batch, size_t n, int outputMode,
+                        SimStats *stats) {
+    unsigned long long logicalMask = (1ULL << vmm->geo.logicalBits) - 1;
+    int fast = vmm->geo.pageBits == PAGE_BITS;
+    int wide = vmm->geo.logicalBits > 32;
+    int pageBits = vmm->geo.pageBits;
+    unsigned long offsetMask = vmm->geo.pageSize - 1;
+    size_t k;
+
+    for (k = 0; k < n; k++) {
+        unsigned long long logicalAddress = batch[k] & logicalMask;
+        int write = (batch[k] & TRACE_WRITE_BIT) != 0;
+        unsigned long physicalAddress;
+
+#if INSTRUMENT
+        if (vmm->ins != NULL) {
+            physicalAddress = instrumentedTranslate(vmm, logicalAddress, write, stats);
+        } else
+#endif
+        if (fast) {
+            physicalAddress = translateDefault(vmm, logicalAddress, write, stats->total, stats);
+        } else {
+            physicalAddress = translateAny(vmm, logicalAddress, write, stats->total, stats);
+        }
+
+        /* Step 5: build physical address, print value, and update counters */
+        if (outputMode != OUTPUT_STATS) {
+            outTranslation(outputMode, wide, logicalAddress, physicalAddress,
+                           vmm->frameData[physicalAddress >> pageBits]
+                                         [physicalAddress & offsetMask]);
+        }
+
+        stats->total++;
+    }
+}
+
+/* loads the pages still predicted and writes back what is dirty at the end of a run */
+static void finishRun(Vmm *vmm, SimStats *stats) {
+    if (vmm->prefetcher != NULL) {
+        finishPrefetch(vmm, stats);
+    }
+    if (stats->writes > 0) {
+        syncVmm(vmm, stats);
+    }
+}
+
+/*
+ * Replays a whole trace through vmm.
+ * Arguments:
+ *   vmm        - Vmm * (already reset)
+ *   tracePath  - const char *
+ *   outputMode - int (OUTPUT_*)
+ *   stats      - SimStats * (filled in)
+ * Returns:
+ *   int - 0 on success, -1 on error (already reported)
+ */
+static int runTrace(Vmm *vmm, const char *tracePath, int outputMode, SimStats *stats) {
+    TraceReader trace;
+    unsigned long long *batch;
+    size_t batchSize;
+    Checkpoint *ck = vmm->ck;
+
+    memset(stats, 0, sizeof(*stats));
+
+    if (openTrace(&trace, tracePath) != 0) {
+        return -1;
+    }
+    if (ck != NULL && ck->resumed) {
+        *stats = ck->stats;
+        if (seekTrace(&trace, ck->traceOffset) != 0) {
+            fprintf(stderr, "%s: cannot seek to the checkpoint\n", tracePath);
+            closeTrace(&trace);
+            return -1;
+        }
+    }
+    if (ck != NULL) {
+        ck->next = (stats->total / ck->every + 1) * ck->every;
+    }
+
+    batch = malloc(TRACE_BATCH * sizeof(unsigned long long));
+    if (batch == NULL) {
+        fprintf(stderr, "Memory allocation failed.\n");
+        closeTrace(&trace);
+        return -1;
+    }
+
+    /* Step 2: read each logical address and get page number + offset */
+    while ((batchSize = readTraceBatch(&trace, batch,
+                                       ck != NULL && ck->next - stats->total < TRACE_BATCH
+                                           ? (size_t)(ck->next - stats->total)
+                                           : TRACE_BATCH)) > 0) {
+        replayBatch(vmm, batch, batchSize, outputMode, stats);
+        if (ck != NULL && stats->total == ck->next) {
+            /* what was printed so far belongs to the snapshot */
+            flushOut();
+            if (writeCheckpoint(vmm, &trace, stats) != 0) {
+                free(batch);
+                closeTrace(&trace);
+                return -1;
+            }
+            ck->next += ck->every;
+        }
+    }
+    finishRun(vmm, stats);
+
+    flushOut();
+    free(batch);
+    closeTrace(&trace);
+    return 0;
+}
+
+/* frames process p holds, counted when the allocator does not track them */
+static int residentFrames(const Vmm *vmm, int p) {
+    int count = 0;
+    int frame;
+
+    if (vmm->resident != NULL) {
+        return vmm->resident[p];
+    }
+    for (frame = 0; frame < vmm->usedFrames; frame++) {
+        count += vmm->framePage[frame] != -1 && vmm->frameAsid[frame] == p;
+    }
+    return count;
+}
+
+/*
+ * Ends one window of the run: the working set of each process is the
+ * pages it touched in the window, and the window thrashes when together
+ * they need more frames than there are. With a timeline, one CSV row per
+ * process is written.
+ * Returns:
+ *   int - 1 if the window thrashed
+ */
+static int endWindow(const Vmm *vmm, long window, long pos, const long *workingSet,
+                     const long *windowFaults, const SimStats *perProcess, FILE *timeline) {
+    long demand = 0;
+    int thrashing;
+    int i;
+
+    for (i = 0; i < vmm->processCount; i++) {
+        demand += workingSet[i];
+    }
+    thrashing = demand > vmm->geo.frameCount;
+
+    for (i = 0; timeline != NULL && i < vmm->processCount; i++) {
+        fprintf(timeline, "%ld,%ld,%d,%d,%ld,%ld,%d\n", window, pos, i, residentFrames(vmm, i),
+                perProcess[i].faults - windowFaults[i], workingSet[i], thrashing);
+    }
+    return thrashing;
+}
+
+/*
+ * Replays one trace per process, round robin with `quantum` addresses per
+ * turn, on the shared frames and TLB. A context switch either keeps the
+ * TLB (its entries are tagged with the ASID) or flushes it. With a
+ * window, every `window` addresses are checked for thrashing and, given a
+ * timeline, logged per process.
+ * Arguments:
+ *   vmm           - Vmm * (already reset, one page table per trace)
+ *   traces        - const char ** (vmm->processCount paths)
+ *   quantum       - long (addresses per turn)
+ *   flushOnSwitch - int
+ *   window        - long (addresses per window, 0 for none)
+ *   timeline      - FILE * (CSV rows per window and process, or NULL)
+ *   stats         - SimStats * (filled in with the totals)
+ *   perProcess    - SimStats * (vmm->processCount entries, filled in)
+ * Returns:
+ *   int - 0 on success, -1 on error (already reported)
+ */
+static int runProcesses(Vmm *vmm, const char **traces, long quantum, int flushOnSwitch,
+                        long window, FILE *timeline, SimStats *stats, SimStats *perProcess) {
+    TraceReader readers[MAX_THREADS];
+    unsigned long long *batches[MAX_THREADS];
+    size_t batchLength[MAX_THREADS];
+    size_t batchPos[MAX_THREADS];
+    int live[MAX_THREADS];
+    PageMap seen[MAX_THREADS];            /* page -> last window it was touched in */
+    long workingSet[MAX_THREADS];
+    long windowFaults[MAX_THREADS];       /* faults before the window began */
+    unsigned long long logicalMask = (1ULL << vmm->geo.logicalBits) - 1;
+    int fast = vmm->geo.pageBits == PAGE_BITS;
+    int local = vmm->allocator != ALLOC_GLOBAL;
+    int count = vmm->processCount;
+    int opened = 0;
+    int running = 0;
+    int current = 0;
+    int status = 0;
+    long pos = 0;
+    long switches = 0;
+    long windows = 0;
+    long thrashing = 0;
+    int i;
+
+    memset(stats, 0, sizeof(*stats));
+    memset(perProcess, 0, (size_t)count * sizeof(SimStats));
+    memset(seen, 0, sizeof(seen));
+    for (i = 0; window > 0 && i < count; i++) {
+        workingSet[i] = 0;
+        windowFaults[i] = 0;
+        if (pageMapInit(&seen[i], vmm->geo.pageCount) != 0) {
+            fprintf(stderr, "Memory allocation failed.\n");
+            status = -1;
+        }
+    }
+    if (timeline != NULL) {
+        fprintf(timeline, "window,address,process,resident,faults,working_set,thrashing\n");
+    }
+
+    for (i = 0; i < count; i++) {
+        batches[i] = NULL;
+        live[i] = 0;
+        if (status != 0 || openTrace(&readers[i], traces[i]) != 0) {
+            status = -1;
+            continue;
+        }
+        opened++;
+        live[i] = 1;
+        running++;
+        batchLength[i] = 0;
+        batchPos[i] = 0;
+        batches[i] = malloc(TRACE_BATCH * sizeof(unsigned long long));
+        if (batches[i] == NULL) {
+            fprintf(stderr, "Memory allocation failed.\n");
+            status = -1;
+        }
+    }
+
+    while (status == 0 && running > 0) {
+        long n;
+        int next;
+
+        for (n = 0; n < quantum && live[current]; n++) {
+            unsigned long long address;
+
+            if (batchPos[current] == batchLength[current]) {
+                batchLength[current] = readTraceBatch(&readers[current], batches[current],
+                                                      TRACE_BATCH);
+                batchPos[current] = 0;
+                if (batchLength[current] == 0) {
+                    live[current] = 0;
+                    running--;
+                    break;
+                }
+            }
+            address = batches[current][batchPos[current]++];
+
+            /* the local allocators age pages in each process's own time */
+            if (fast) {
+                translateDefault(vmm, address & logicalMask, (address & TRACE_WRITE_BIT) != 0,
+                                 local ? perProcess[current].total : pos, &perProcess[current]);
+            } else {
+                translateAny(vmm, address & logicalMask, (address & TRACE_WRITE_BIT) != 0,
+                             local ? perProcess[current].total : pos, &perProcess[current]);
+            }
+            perProcess[current].total++;
+            pos++;
+
+            if (window > 0) {
+                long long page = (long long)((address & logicalMask) >> vmm->geo.pageBits);
+
+                if (pageMapGet(&seen[current], page) != windows + 1) {
+                    if (pageMapPut(&seen[current], page, windows + 1) != 0) {
+                        fprintf(stderr, "Memory allocation failed.\n");
+                        exit(1);
+                    }
+                    workingSet[current]++;
+                }
+                if (pos % window == 0) {
+                    for (i = 0; local && i < count; i++) {
+                        trimResidentSet(vmm, i, perProcess[i].total, &perProcess[i]);
+                    }
+                    thrashing += endWindow(vmm, windows, pos, workingSet, windowFaults,
+                                           perProcess, timeline);
+                    windows++;
+                    for (i = 0; i < count; i++) {
+                        workingSet[i] = 0;
+                        windowFaults[i] = perProcess[i].faults;
+                    }
+                }
+            }
+        }
+
+        /* Step 3 for the next process: switch the page table and the TLB's ASID */
+        next = current;
+        for (i = 1; i <= count; i++) {
+            if (live[(current + i) % count]) {
+                next = (current + i) % count;
+                break;
+            }
+        }
+        if (next != current) {
+            switches++;
+            if (flushOnSwitch) {
+                resetTLB(&vmm->tlb);
+            }
+            vmm->asid = next;
+            vmm->tlb.asid = next;
+            current = next;
+        }
+    }
+
+    for (i = 0; i < count; i++) {
+        stats->total += perProcess[i].total;
+        stats->faults += perProcess[i].faults;
+        stats->hits += perProcess[i].hits;
+        stats->bytesCopied += perProcess[i].bytesCopied;
+        stats->writes += perProcess[i].writes;
+        stats->writeBacks += perProcess[i].writeBacks;
+        stats->writeBackBytes += perProcess[i].writeBackBytes;
+        stats->writeBackCalls += perProcess[i].writeBackCalls;
+        stats->releases += perProcess[i].releases;
+    }
+    stats->contextSwitches = switches;
+
+    /* the last, partial window */
+    if (status == 0 && window > 0 && pos % window != 0) {
+        thrashing += endWindow(vmm, windows, pos, workingSet, windowFaults, perProcess, timeline);
+        windows++;
+    }
+    stats->windows = windows;
+    stats->thrashingWindows = thrashing;
+
+    if (status == 0 && stats->writes > 0) {
+        syncVmm(vmm, stats);
+    }
+
+    for (i = 0; i < count; i++) {
+        if (i < opened) {
+            closeTrace(&readers[i]);
+        }
+        free(batches[i]);
+        pageMapFree(&seen[i]);
+    }
+    return status;
+}
+
+/*
+ * Runs every policy but OPT (which needs a single trace) twice, keeping
+ * the TLB across context switches (ASID tags) and flushing it, and prints
+ * the extra TLB misses a flush costs per switch.
+ * Arguments:
+ *   vmm     - Vmm * (one page table per trace)
+ *   traces  - const char **
+ *   quantum - long
+ * Returns:
+ *   int - 0 on success, -1 on error (already reported)
+ */
+static int compareSwitchModes(Vmm *vmm, const char **traces, long quantum) {
+    SimStats stats[2];
+    SimStats *perProcess = malloc((size_t)vmm->processCount * sizeof(SimStats));
+    int i;
+    int mode;
+
+    if (perProcess == NULL) {
+        fprintf(stderr, "Memory allocation failed.\n");
+        return -1;
+    }
+
+    printf("%-8s %15s %15s %12s %15s %15s %15s\n", "Policy", "Total addresses", "Page_faults",
+           "Switches", "Misses (ASID)", "Misses (flush)", "Misses/switch");
+    for (i = 0; i < POLICY_COUNT; i++) {
+        if (strcmp(policies[i].name, "OPT") == 0) {
+            continue;
+        }
+        for (mode = 0; mode < 2; mode++) {
+            if (resetVmm(vmm, &policies[i]) != 0 ||
+                runProcesses(vmm, traces, quantum, mode, 0, NULL, &stats[mode], perProcess) != 0) {
+                free(perProcess);
+                return -1;
+            }
+        }
+        printf("%-8s %15ld %15ld %12ld %15ld %15ld %15.2f\n", policies[i].name,
+               stats[0].total, stats[0].faults, stats[0].contextSwitches,
+               stats[0].total - stats[0].hits, stats[1].total - stats[1].hits,
+               stats[0].contextSwitches > 0
+                   ? (double)((stats[1].total - stats[1].hits) - (stats[0].total - stats[0].hits)) /
+                         stats[0].contextSwitches
+                   : 0.0);
+    }
+
+    free(perProcess);
+    return 0;
+}
+
+/*
+ * Mattson stack distances in one pass. Each page keeps a marker at the
+ * time slot of its last access; the LRU stack distance of an access is
+ * the number of markers newer than the page's previous one, counted with
+ * a Fenwick tree. Slots are renumbered once they run out (and doubled if
+ * more than half are live), so memory stays proportional to the pages
+ * touched however long the trace is.
+ */
+typedef struct {
+    int *tree;
+    PageMap last;
+    long long *slotPage;
+    int slots;
+    int nextSlot;
+    int markers;
+} StackDistance;
+
+static void sdAdd(StackDistance *sd, int slot, int delta) {
+    for (slot++; slot <= sd->slots; slot += slot & -slot) {
+        sd->tree[slot] += delta;
+    }
+}
+
+/* markers in slots [0, slot] */
+static int sdPrefix(const StackDistance *sd, int slot) {
+    int sum = 0;
+    for (slot++; slot > 0; slot -= slot & -slot) {
+        sum += sd->tree[slot];
+    }
+    return sum;
+}
+
+/* packs the live markers into slots [0, markers) keeping their order */
+static int sdCompact(StackDistance *sd) {
+    int slot;
+    int next = 0;
+
+    for (slot = 0; slot < sd->slots; slot++) {
+        long long page = sd->slotPage[slot];
+        if (page != -1) {
+            sd->slotPage[slot] = -1;
+            sd->slotPage[next] = page;
+            if (pageMapPut(&sd->last, page, next) != 0) {
+                return -1;
+            }
+            next++;
+        }
+    }
+
+    if (2 * next > sd->slots) {
+        int *tree = realloc(sd->tree, ((size_t)2 * sd->slots + 1) * sizeof(int));
+        long long *slotPage;
+
+        if (tree == NULL) {
+            return -1;
+        }
+        sd->tree = tree;
+        slotPage = realloc(sd->slotPage, (size_t)2 * sd->slots * sizeof(long long));
+        if (slotPage == NULL) {
+            return -1;
+        }
+        sd->slotPage = slotPage;
+        memset(sd->slotPage + sd->slots, -1, (size_t)sd->slots * sizeof(long long));
+        sd->slots *= 2;
+    }
+
+    memset(sd->tree, 0, (size_t)(sd->slots + 1) * sizeof(int));
+    for (slot = 0; slot < next; slot++) {
+        sdAdd(sd, slot, 1);
+    }
+    sd->nextSlot = next;
+    return 0;
+}
+
+/*
+ * Arguments:
+ *   sd   - StackDistance *
+ *   page - long long
+ * Returns:
+ *   int - LRU stack distance (1 = most recently used), 0 on first touch,
+ *         -1 if memory ran out
+ */
+static int sdAccess(StackDistance *sd, long long page) {
+    long last = pageMapGet(&sd->last, page);
+    int distance = 0;
+
+    if (sd->nextSlot == sd->slots) {
+        if (sdCompact(sd) != 0) {
+            return -1;
+        }
+        last = pageMapGet(&sd->last, page);
+    }
+
+    if (last != -1) {
+        distance = sd->markers - sdPrefix(sd, (int)last) + 1;
+        sdAdd(sd, (int)last, -1);
+        sd->slotPage[last] = -1;
+        sd->markers--;
+    }
+
+    if (pageMapPut(&sd->last, page, sd->nextSlot) != 0) {
+        return -1;
+    }
+    sd->slotPage[sd->nextSlot] = page;
+    sdAdd(sd, sd->nextSlot, 1);
+    sd->nextSlot++;
+    sd->markers++;
+    return distance;
+}
+
+/*
+ * Prints, for every size from 1 to the page count, the LRU page fault
+ * count with that many frames and the hit count of a fully associative
+ * LRU TLB with that many entries, all from a single pass over the trace.
+ * Above SD_MAX_ROWS pages the rows stop at the distinct pages touched,
+ * since every larger size gives the same numbers.
+ * Arguments:
+ *   tracePath - const char *
+ *   geo       - const Geometry *
+ * Returns:
+ *   int - 0 on success, 1 on error
+ */
+static int runStackDistance(const char *tracePath, const Geometry *geo) {
+    TraceReader trace;
+    StackDistance sd;
+    unsigned long long *batch;
+    long *histogram;
+    long histogramSize;
+    long coldMisses = 0;
+    long total = 0;
+    long beyond;
+    long within = 0;
+    unsigned long long logicalMask = (1ULL << geo->logicalBits) - 1;
+    size_t batchSize;
+    size_t k;
+    long rows;
+    long size;
+    int status = 0;
+
+    if (openTrace(&trace, tracePath) != 0) {
+        return 1;
+    }
+
+    /* slots for 4x the page count keep renumbering rare; sparse spaces start small and grow */
+    memset(&sd, 0, sizeof(sd));
+    sd.slots = geo->pageCount <= (1 << 16) ? 4 * (int)geo->pageCount : (1 << 18);
+    histogramSize = geo->pageCount <= (1 << 16) ? geo->pageCount + 1 : (1 << 16);
+    sd.tree = calloc((size_t)sd.slots + 1, sizeof(int));
+    sd.slotPage = malloc((size_t)sd.slots * sizeof(long long));
+    histogram = calloc((size_t)histogramSize, sizeof(long));
+    batch = malloc(TRACE_BATCH * sizeof(unsigned long long));
+    if (sd.tree == NULL || sd.slotPage == NULL || histogram == NULL || batch == NULL ||
+        pageMapInit(&sd.last, geo->pageCount) != 0) {
+        fprintf(stderr, "Memory allocation failed.\n");
+        status = 1;
+    } else {
+        memset(sd.slotPage, -1, (size_t)sd.slots * sizeof(long long));
+    }
+
+    while (status == 0 && (batchSize = readTraceBatch(&trace, batch, TRACE_BATCH)) > 0) {
+        for (k = 0; k < batchSize; k++) {
+            int distance = sdAccess(&sd, (long long)((batch[k] & logicalMask) >> geo->pageBits));
+
+            if (distance < 0) {
+                fprintf(stderr, "Memory allocation failed.\n");
+                status = 1;
+                break;
+            }
+            if (distance == 0) {
+                coldMisses++;
+            } else {
+                if (distance >= histogramSize) {
+                    long *grown = realloc(histogram, 2 * (size_t)histogramSize * sizeof(long));
+                    if (grown == NULL) {
+                        fprintf(stderr, "Memory allocation failed.\n");
+                        status = 1;
+                        break;
+                    }
+                    histogram = grown;
+                    memset(histogram + histogramSize, 0, (size_t)histogramSize * sizeof(long));
+                    histogramSize *= 2;
+                }
+                histogram[distance]++;
+            }
+        }
+        total += (long)batchSize;
+    }
+
+    if (status == 0) {
+        rows = geo->pageCount <= SD_MAX_ROWS ? (long)geo->pageCount
+                                             : (sd.markers > 0 ? sd.markers : 1);
+
+        /* an access faults with n frames iff it is cold or its distance is > n */
+        printf("Size,Page_faults,Fault_rate,TLB_hits,TLB_hit_rate\n");
+        beyond = total - coldMisses;
+        for (size = 1; size <= rows; size++) {
+            if (size < histogramSize) {
+                within += histogram[size];
+                beyond -= histogram[size];
+            }
+            printf("%ld,%ld,%.6f,%ld,%.6f\n", size,
+                   coldMisses + beyond,
+                   total > 0 ? (double)(coldMisses + beyond) / total : 0.0,
+                   within,
+                   total > 0 ? (double)within / total : 0.0);
+        }
+    }
+
+    free(batch);
+    closeTrace(&trace);
+    free(sd.tree);
+    pageMapFree(&sd.last);
+    free(sd.slotPage);
+    free(histogram);
+    return status;
+}
+
+
+/*
+ * Times every available probe on 16-, 64- and 512-entry TLBs filled with
+ * random pages, looked up with roughly half hits.
+ * Returns:
+ *   int - 0 on success, 1 if the probes disagree or allocation fails
+ */
+static int runTLBBench(void) {
+    static const int sizes[] = { 16, 64, TLB_BENCH_MAX };
+    static const char *names[] = { "index", "scalar", "sse4", "avx2" };
+    enum { KEYS = 1 << 16, ROUNDS = 64 };
+    int tags[TLB_BENCH_MAX];
+    unsigned long long valid[TLB_BENCH_MAX / 64];
+    int index[4 * TLB_BENCH_MAX];
+    int *keys;
+    int *expect;
+    int s, p, r, k;
+
+    keys = malloc(KEYS * sizeof(int));
+    expect = malloc(KEYS * sizeof(int));
+    if (keys == NULL || expect == NULL) {
+        fprintf(stderr, "Memory allocation failed.\n");
+        free(keys);
+        free(expect);
+        return 1;
+    }
+
+    srand(1);
+    printf("TLB probe benchmark (ns/lookup)\n");
+    printf("%8s", "entries");
+    for (p = 0; p < 4; p++) {
+        printf("%10s", names[p]);
+    }
+    printf("\n");
+
+    for (s = 0; s < 3; s++) {
+        TLBTags t = { tags, valid, sizes[s] };
+        int pageRange = 4 * sizes[s];
+
+        /* distinct random pages out of 4x the TLB size */
+        for (k = 0; k < pageRange; k++) {
+            index[k] = -1;
+        }
+        memset(valid, 0, sizeof(valid));
+        for (k = 0; k < sizes[s]; k++) {
+            int page;
+            do {
+                page = rand() % pageRange;
+            } while (index[page] != -1);
+            tags[k] = page;
+            index[page] = k;
+            valid[k >> 6] |= 1ULL << (k & 63);
+        }
+
+        /* keys from 2x the TLB size: about half of them hit */
+        for (k = 0; k < KEYS; k++) {
+            keys[k] = rand() % (2 * sizes[s]);
+            expect[k] = index[keys[k]];
+        }
+
+        printf("%8d", sizes[s]);
+        for (p = 0; p < 4; p++) {
+            TLBProbe probe = NULL;
+            volatile int sink = 0;
+            double start;
+            double elapsed;
+
+            if (p > 0 && !selectTLBProbe(names[p], &probe)) {
+                printf("%10s", "n/a");
+                continue;
+            }
+
+            for (k = 0; k < KEYS; k++) {
+                int got = probe != NULL ? probe(&t, keys[k]) : index[keys[k]];
+                if (got != expect[k]) {
+                    printf("\n%s probe returned %d for page %d, expected %d\n",
+                           names[p], got, keys[k], expect[k]);
+                    free(keys);
+                    free(expect);
+                    return 1;
+                }
+            }
+
+            start = nowNs();
+            for (r = 0; r < ROUNDS; r++) {
+                if (probe != NULL) {
+                    for (k = 0; k < KEYS; k++) {
+                        sink += probe(&t, keys[k]);
+                    }
+                } else {
+                    for (k = 0; k < KEYS; k++) {
+                        sink += index[keys[k]];
+                    }
+                }
+            }
+            elapsed = nowNs() - start;
+            printf("%10.2f", elapsed / ((double)ROUNDS * KEYS));
+        }
+        printf("\n");
+    }
+
+    free(keys);
+    free(expect);
+    return 0;
+}
+
+/* cycles on x86 (reference cycles, from rdtsc), ns elsewhere */
+#ifdef HAVE_X86_SIMD
+#define BENCH_UNIT "cycles"
+static inline unsigned long long benchClock(void) {
+    return __rdtsc();
+}
+#else
+#define BENCH_UNIT "ns"
+static inline unsigned long long benchClock(void) {
+    return (unsigned long long)nowNs();
+}
+#endif
+
+enum { CASE_TLB_HIT, CASE_TABLE_HIT, CASE_FAULT, CASE_COUNT };
+
+/*
+ * Replays a trace timing every translation on its own, as a TLB hit, a
+ * page table hit or a fault, and hashes every translation (logical and
+ * physical address, value).
+ * Arguments:
+ *   vmm       - Vmm * (reset for the run)
+ *   path      - const char *
+ *   overhead  - double (cost of reading the clock twice)
+ *   stats     - SimStats * (filled in)
+ *   cost      - double[CASE_COUNT] (filled in: mean per case)
+ *   count     - long[CASE_COUNT] (filled in)
+ *   checksum  - unsigned long long * (filled in)
+ * Returns:
+ *   int - 0 on success, -1 on error (already reported)
+ */
+static int timeCases(Vmm *vmm, const char *path, double overhead, SimStats *stats,
+                     double cost[CASE_COUNT], long count[CASE_COUNT],
+                     unsigned long long *checksum) {
+    TraceReader trace;
+    unsigned long long *batch;
+    unsigned long long logicalMask = (1ULL << vmm->geo.logicalBits) - 1;
+    unsigned long long total[CASE_COUNT] = { 0, 0, 0 };
+    unsigned long long hash = 14695981039346656037ULL;     /* FNV-1a */
+    int fast = vmm->geo.pageBits == PAGE_BITS;
+    size_t batchSize;
+    size_t k;
+    int c;
+
+    memset(stats, 0, sizeof(*stats));
+    memset(count, 0, CASE_COUNT * sizeof(long));
+    if (openTrace(&trace, path) != 0) {
+        return -1;
+    }
+    batch = malloc(TRACE_BATCH * sizeof(unsigned long long));
+    if (batch == NULL) {
+        fprintf(stderr, "Memory allocation failed.\n");
+        closeTrace(&trace);
+        return -1;
+    }
+
+    while ((batchSize = readTraceBatch(&trace, batch, TRACE_BATCH)) > 0) {
+        for (k = 0; k < batchSize; k++) {
+            unsigned long long logicalAddress = batch[k] & logicalMask;
+            int write = (batch[k] & TRACE_WRITE_BIT) != 0;
+            long hits = stats->hits;
+            long faults = stats->faults;
+            unsigned long long start = benchClock();
+            unsigned long physicalAddress =
+                fast ? translateDefault(vmm, logicalAddress, write, stats->total, stats)
+                     : translateAny(vmm, logicalAddress, write, stats->total, stats);
+            unsigned long long elapsed = benchClock() - start;
+
+            c = stats->faults != faults ? CASE_FAULT
+                : stats->hits != hits   ? CASE_TLB_HIT
+                                        : CASE_TABLE_HIT;
+            total[c] += elapsed;
+            count[c]++;
+
+            hash = (hash ^ logicalAddress) * 1099511628211ULL;
+            hash = (hash ^ physicalAddress) * 1099511628211ULL;
+            hash = (hash ^ (unsigned char)vmm->frameData[physicalAddress >> vmm->geo.pageBits]
+                                                       [physicalAddress & (vmm->geo.pageSize - 1)]) *
+                   1099511628211ULL;
+            stats->total++;
+        }
+    }
+    finishRun(vmm, stats);
+
+    for (c = 0; c < CASE_COUNT; c++) {
+        cost[c] = count[c] > 0 ? (double)total[c] / count[c] - overhead : 0.0;
+    }
+    *checksum = hash;
+    free(batch);
+    closeTrace(&trace);
+    return 0;
+}
+
+/*
+ * Generates every distribution, replays it with the configured machine and
+ * prints translations per second (a plain stats-only run) and the cost of
+ * each kind of translation. The faults, hits and a hash of every
+ * translation are checked against golden results: lines in
+ * goldenPath with the same trace and machine, or, if the file does not
+ * exist yet, written there for later runs to check against.
+ * Arguments:
+ *   vmm        - Vmm *
+ *   policy     - const ReplacementPolicy *
+ *   base       - const TraceSpec * (all but dist)
+ *   goldenPath - const char * (NULL to skip the check)
+ * Returns:
+ *   int - 0 on success, 1 on error or a mismatch
+ */
+static int runBench(Vmm *vmm, const ReplacementPolicy *policy, const TraceSpec *base,
+                    const char *goldenPath) {
+    char *golden = NULL;
+    FILE *goldenOut = NULL;
+    unsigned long long clockCost = 0;
+    double overhead;
+    int mismatches = 0;
+    int missing = 0;
+    int status = 0;
+    int d;
+
+    if (goldenPath != NULL) {
+        FILE *in = fopen(goldenPath, "r");
+
+        if (in != NULL) {
+            struct stat gst;
+            /* leading newline: every line can be found as "\n" + key */
+            if (fstat(fileno(in), &gst) != 0 || (golden = calloc((size_t)gst.st_size + 2, 1)) == NULL) {
+                fprintf(stderr, "Cannot read %s\n", goldenPath);
+                fclose(in);
+                return 1;
+            }
+            golden[0] = '\n';
+            if (fread(golden + 1, 1, (size_t)gst.st_size, in) != (size_t)gst.st_size) {
+                perror(goldenPath);
+                fclose(in);
+                free(golden);
+                return 1;
+            }
+            fclose(in);
+        } else if ((goldenOut = fopen(goldenPath, "w")) == NULL) {
+            perror(goldenPath);
+            return 1;
+        }
+    }
+
+    /* what the two clock reads around a translation cost by themselves */
+    for (d = 0; d < 10000; d++) {
+        unsigned long long t = benchClock();
+        clockCost += benchClock() - t;
+    }
+    overhead = clockCost / 10000.0;
+
+    printf("%llu accesses per trace, %s, %d frames, %d TLB entries (" BENCH_UNIT
+           " per translation)\n",
+           base->count, policy->name, vmm->geo.frameCount, vmm->geo.tlbCount);
+    printf("%-8s %15s %10s %10s %10s %8s %8s %8s %8s\n", "Trace", "Translations/s",
+           "TLB hit", "PT hit", "Fault", "Hits", "PT hits", "Faults", "Golden");
+
+    for (d = 0; d < DISTRIBUTION_COUNT && status == 0; d++) {
+        TraceSpec spec = *base;
+        char path[] = "/tmp/assignment3-bench-XXXXXX";
+        char key[160];
+        char line[256];
+        const char *result = "-";
+        double cost[CASE_COUNT];
+        long count[CASE_COUNT];
+        unsigned long long checksum;
+        SimStats stats;
+        SimStats timed;
+        double elapsed;
+        FILE *out;
+        int fd;
+
+        spec.dist = d;
+        fd = mkstemp(path);
+        if (fd < 0 || (out = fdopen(fd, "wb")) == NULL) {
+            perror("mkstemp");
+            if (fd >= 0) {
+                close(fd);
+                unlink(path);
+            }
+            status = 1;
+            break;
+        }
+        if (writeGeneratedTrace(out, &spec, &vmm->geo) != 0) {
+            fclose(out);
+            unlink(path);
+            status = 1;
+            break;
+        }
+        if (fclose(out) != 0) {
+            perror(path);
+            unlink(path);
+            status = 1;
+            break;
+        }
+
+        elapsed = nowNs();
+        if (resetVmm(vmm, policy) != 0 || runTrace(vmm, path, OUTPUT_STATS, &stats) != 0) {
+            unlink(path);
+            status = 1;
+            break;
+        }
+        elapsed = nowNs() - elapsed;
+        if (resetVmm(vmm, policy) != 0 ||
+            timeCases(vmm, path, overhead, &timed, cost, count, &checksum) != 0) {
+            unlink(path);
+            status = 1;
+            break;
+        }
+        unlink(path);
+
+        if (timed.faults != stats.faults || timed.hits != stats.hits) {
+            fprintf(stderr, "%s: timed replay disagrees with runTrace\n", distributions[d].name);
+            status = 1;
+            break;
+        }
+
+        snprintf(key, sizeof(key), "%s %llu %llu %llu %lld %s %d %d %d", distributions[d].name,
+                 spec.count, spec.seed, spec.stride, spec.workingSet, policy->name,
+                 vmm->geo.pageBits, vmm->geo.frameCount, vmm->geo.tlbCount);
+        snprintf(line, sizeof(line), "%s %ld %ld %016llx", key, stats.faults, stats.hits, checksum);
+        /* superpage lines also hold the promotions, which must go on after memory fills */
+        if (vmm->geo.superpagePages > 0) {
+            snprintf(key + strlen(key), sizeof(key) - strlen(key), " superpage %d %d",
+                     vmm->geo.superpagePages, vmm->geo.superpageTlbCount);
+            snprintf(line, sizeof(line), "%s %ld %ld %016llx %ld", key, stats.faults, stats.hits,
+                     checksum, stats.promotions);
+        }
+        if (goldenOut != NULL) {
+            fprintf(goldenOut, "%s\n", line);
+            result = "written";
+        } else if (golden != NULL) {
+            size_t keyLength = strlen(key);
+            const char *p = golden;
+
+            while ((p = strchr(p, '\n')) != NULL) {
+                p++;
+                /* the results start with a digit; a longer key (superpages) goes on with a word */
+                if (strncmp(p, key, keyLength) == 0 && p[keyLength] == ' ' &&
+                    p[keyLength + 1] >= '0' && p[keyLength + 1] <= '9') {
+                    break;
+                }
+            }
+            if (p == NULL) {
+                /* a machine the file has no results for is not a pass */
+                result = "MISSING";
+                missing++;
+            } else {
+                size_t length = strlen(line);
+                if (strncmp(p, line, length) == 0 && (p[length] == '\n' || p[length] == '\0')) {
+                    result = "ok";
+                } else {
+                    result = "MISMATCH";
+                    mismatches++;
+                }
+            }
+        }
+
+        printf("%-8s %15.0f %10.1f %10.1f %10.1f %8ld %8ld %8ld %8s\n", distributions[d].name,
+               elapsed > 0 ? stats.total / (elapsed / 1e9) : 0.0,
+               cost[CASE_TLB_HIT], cost[CASE_TABLE_HIT], cost[CASE_FAULT],
+               count[CASE_TLB_HIT], count[CASE_TABLE_HIT], count[CASE_FAULT], result);
+    }
+
+    if (goldenOut != NULL && fclose(goldenOut) != 0) {
+        perror(goldenPath);
+        status = 1;
+    }
+    free(golden);
+    if (mismatches > 0) {
+        fprintf(stderr, "%d trace(s) differ from %s\n", mismatches, goldenPath);
+        status = 1;
+    }
+    if (missing > 0) {
+        fprintf(stderr, "%d trace(s) have no line in %s; give a new FILE to write them\n", missing,
+                goldenPath);
+        status = 1;
+    }
+    return status;
+}
+
+/*
+ * N-core replay. Every thread replays its own trace through a private
+ * TLB; the page table and the frames are shared. Page table reads are
+ * plain atomic loads. A fault claims the page by swapping -1 for
+ * PTE_LOADING, takes a frame from its own free list (stealing from the
+ * others when it is empty) or evicts one with a global CLOCK hand, and
+ * publishes the frame with a release store. Evicting a frame sends a TLB
+ * shootdown to every other core that may cache it (tracked per frame)
+ * and waits for their acks; cores handle shootdowns before each access
+ * and while they wait. Stores are replayed as loads.
+ */
+typedef struct {
+    long long page;
+    int sender;
+} Shootdown;
+
+typedef struct SmpMachine SmpMachine;
+
+typedef struct {
+    SmpMachine *m;
+    int id;
+    TLB tlb;
+    unsigned long long *trace;
+    size_t traceLength;
+
+    pthread_mutex_t inboxLock;      /* shootdowns sent to this core */
+    Shootdown *inbox;
+    int inboxCount;
+    int inboxCapacity;
+    atomic_int inboxPending;
+    atomic_int outstanding;         /* shootdowns this core sent, not acked yet */
+
+    pthread_mutex_t freeLock;       /* this core's free frames */
+    int *freeFrames;
+    atomic_int freeCount;           /* written under freeLock, peeked without it */
+
+    long total;
+    long faults;
+    long hits;
+    long faultWaits;                /* accesses that waited for another core's fault */
+    long shootdowns;                /* evictions that had to shoot down other TLBs */
+    long ipisSent;
+    long ipisReceived;
+    double shootdownNs;             /* time spent waiting for acks */
+    double elapsedNs;
+    long long checksum;             /* keeps the data reads */
+} SmpCpu;
+
+struct SmpMachine {
+    Geometry geo;
+    const signed char *backingData;
+    size_t backingSize;
+    signed char *ram;
+    atomic_int *pageTable;                  /* page -> frame, -1, or PTE_LOADING */
+    atomic_llong *framePage;
+    atomic_ullong *frameCpus;               /* cores whose TLB may hold the frame */
+    atomic_uchar *frameRef;
+    atomic_int *frameBusy;                  /* free, being loaded or being evicted */
+    atomic_ulong hand;
+    atomic_int finished;
+    int cpuCount;
+    SmpCpu cpus[MAX_THREADS];
+    pthread_barrier_t start;
+};
+
+/* acks every shootdown queued for cpu */
+static void smpServiceInbox(SmpCpu *cpu) {
+    int i;
+
+    if (atomic_load_explicit(&cpu->inboxPending, memory_order_acquire) == 0) {
+        return;
+    }
+    pthread_mutex_lock(&cpu->inboxLock);
+    for (i = 0; i < cpu->inboxCount; i++) {
+        removeFromTLB(&cpu->tlb, 0, cpu->inbox[i].page);
+        cpu->ipisReceived++;
+        atomic_fetch_sub_explicit(&cpu->m->cpus[cpu->inbox[i].sender].outstanding, 1,
+                                  memory_order_release);
+    }
+    cpu->inboxCount = 0;
+    atomic_store_explicit(&cpu->inboxPending, 0, memory_order_relaxed);
+    pthread_mutex_unlock(&cpu->inboxLock);
+}
+
+/* spins politely; the other cores may share this CPU */
+static void smpWait(SmpCpu *cpu) {
+    smpServiceInbox(cpu);
+    sched_yield();
+}
+
+/*
+ * Removes page (just unmapped from frame) from every TLB that may hold it
+ * and waits until the other cores have acked.
+ * Arguments:
+ *   cpu   - SmpCpu * (the evicting core)
+ *   frame - int
+ *   page  - long long
+ * Returns:
+ *   void
+ */
+static void smpShootdown(SmpCpu *cpu, int frame, long long page) {
+    SmpMachine *m = cpu->m;
+    unsigned long long holders = atomic_exchange(&m->frameCpus[frame], 0);
+    double start;
+    int target;
+
+    if (holders & (1ULL << cpu->id)) {
+        removeFromTLB(&cpu->tlb, 0, page);
+        holders &= ~(1ULL << cpu->id);
+    }
+    if (holders == 0) {
+        return;
+    }
+
+    cpu->shootdowns++;
+    for (target = 0; target < m->cpuCount; target++) {
+        SmpCpu *t = &m->cpus[target];
+
+        if (!(holders & (1ULL << target))) {
+            continue;
+        }
+        atomic_fetch_add_explicit(&cpu->outstanding, 1, memory_order_relaxed);
+        pthread_mutex_lock(&t->inboxLock);
+        if (t->inboxCount == t->inboxCapacity) {
+            Shootdown *grown;
+            t->inboxCapacity = t->inboxCapacity == 0 ? 16 : t->inboxCapacity * 2;
+            grown = realloc(t->inbox, (size_t)t->inboxCapacity * sizeof(Shootdown));
+            if (grown == NULL) {
+                fprintf(stderr, "Memory allocation failed.\n");
+                exit(1);
+            }
+            t->inbox = grown;
+        }
+        t->inbox[t->inboxCount].page = page;
+        t->inbox[t->inboxCount].sender = cpu->id;
+        t->inboxCount++;
+        atomic_store_explicit(&t->inboxPending, 1, memory_order_release);
+        pthread_mutex_unlock(&t->inboxLock);
+        cpu->ipisSent++;
+    }
+
+    start = nowNs();
+    while (atomic_load_explicit(&cpu->outstanding, memory_order_acquire) > 0) {
+        smpWait(cpu);
+    }
+    cpu->shootdownNs += nowNs() - start;
+}
+
+/* pops a frame from cpu's free list, or from another core's; -1 when all are empty */
+static int smpTakeFreeFrame(SmpCpu *cpu) {
+    SmpMachine *m = cpu->m;
+    int frame = -1;
+    int i;
+
+    for (i = 0; i < m->cpuCount && frame == -1; i++) {
+        SmpCpu *c = &m->cpus[(cpu->id + i) % m->cpuCount];
+
+        int n;
+
+        /* unlocked peek so empty lists cost no lock traffic */
+        if (atomic_load_explicit(&c->freeCount, memory_order_relaxed) == 0) {
+            continue;
+        }
+        pthread_mutex_lock(&c->freeLock);
+        n = atomic_load_explicit(&c->freeCount, memory_order_relaxed);
+        if (n > 0) {
+            frame = c->freeFrames[n - 1];
+            atomic_store_explicit(&c->freeCount, n - 1, memory_order_relaxed);
+        }
+        pthread_mutex_unlock(&c->freeLock);
+    }
+    return frame;
+}
+
+/*
+ * Arguments:
+ *   cpu - SmpCpu *
+ * Returns:
+ *   int - a frame now owned (busy) by cpu, its old page unmapped everywhere
+ */
+static int smpAllocFrame(SmpCpu *cpu) {
+    SmpMachine *m = cpu->m;
+    int frame = smpTakeFreeFrame(cpu);
+    long long oldPage;
+    int expected;
+
+    if (frame != -1) {
+        return frame;
+    }
+
+    /* CLOCK over all frames: skip busy ones, give referenced ones a second chance */
+    for (;;) {
+        frame = (int)(atomic_fetch_add_explicit(&m->hand, 1, memory_order_relaxed) %
+                      (unsigned long)m->geo.frameCount);
+        if (frame == 0) {
+            smpServiceInbox(cpu);
+        }
+        if (atomic_load_explicit(&m->frameBusy[frame], memory_order_relaxed) ||
+            atomic_exchange_explicit(&m->frameRef[frame], 0, memory_order_relaxed)) {
+            continue;
+        }
+        expected = 0;
+        if (atomic_compare_exchange_strong(&m->frameBusy[frame], &expected, 1)) {
+            break;
+        }
+    }
+
+    oldPage = atomic_load_explicit(&m->framePage[frame], memory_order_relaxed);
+    atomic_store(&m->pageTable[oldPage], -1);
+    smpShootdown(cpu, frame, oldPage);
+    return frame;
+}
+
+/*
+ * Caches page -> frame in cpu's TLB and records cpu as a holder of frame.
+ * Returns:
+ *   int - 1 if the mapping is still current, 0 if an eviction raced it
+ */
+static int smpFillTLB(SmpCpu *cpu, long long page, int frame) {
+    SmpMachine *m = cpu->m;
+    TLBItem *victim = &cpu->tlb.items[cpu->tlb.next];
+
+    if (victim->entry & PTE_VALID) {
+        atomic_fetch_and(&m->frameCpus[victim->entry & PTE_FRAME_MASK], ~(1ULL << cpu->id));
+    }
+    addToTLB(&cpu->tlb, page, frame);
+    atomic_fetch_or(&m->frameCpus[frame], 1ULL << cpu->id);
+
+    /* an evictor that cleared the table before our bit was set did not shoot us down */
+    if (atomic_load(&m->pageTable[page]) != frame) {
+        removeFromTLB(&cpu->tlb, 0, page);
+        return 0;
+    }
+    return 1;
+}
+
+static void smpAccess(SmpCpu *cpu, unsigned long long logicalAddress) {
+    SmpMachine *m = cpu->m;
+    int pageBits = m->geo.pageBits;
+    long long page = (long long)(logicalAddress >> pageBits);
+    unsigned long offset = (unsigned long)logicalAddress & (m->geo.pageSize - 1);
+    int waited = 0;
+    int frame;
+
+    smpServiceInbox(cpu);
+
+    frame = findInTLB(&cpu->tlb, page);
+    if (frame != -1) {
+        cpu->hits++;
+    }
+    while (frame == -1) {
+        int entry = atomic_load_explicit(&m->pageTable[page], memory_order_acquire);
+
+        if (entry >= 0) {
+            if (smpFillTLB(cpu, page, entry)) {
+                frame = entry;
+            }
+            continue;
+        }
+
+        if (entry == -1 &&
+            atomic_compare_exchange_strong(&m->pageTable[page], &entry, PTE_LOADING)) {
+            size_t start = (size_t)page << pageBits;
+            size_t have = start < m->backingSize ? m->backingSize - start : 0;
+            signed char *dst;
+            int loaded;
+
+            cpu->faults++;
+            loaded = smpAllocFrame(cpu);
+            dst = m->ram + ((size_t)loaded << pageBits);
+            if (have > m->geo.pageSize) {
+                have = m->geo.pageSize;
+            }
+            memcpy(dst, m->backingData + start, have);
+            memset(dst + have, 0, m->geo.pageSize - have);
+
+            atomic_store_explicit(&m->framePage[loaded], page, memory_order_relaxed);
+            atomic_store_explicit(&m->frameRef[loaded], 1, memory_order_relaxed);
+            atomic_store_explicit(&m->pageTable[page], loaded, memory_order_release);
+            atomic_store_explicit(&m->frameBusy[loaded], 0, memory_order_release);
+            continue;
+        }
+
+        /* another core is loading the page */
+        if (!waited) {
+            cpu->faultWaits++;
+            waited = 1;
+        }
+        smpWait(cpu);
+    }
+
+    if (!atomic_load_explicit(&m->frameRef[frame], memory_order_relaxed)) {
+        atomic_store_explicit(&m->frameRef[frame], 1, memory_order_relaxed);
+    }
+    cpu->checksum += m->ram[((size_t)frame << pageBits) + offset];
+    cpu->total++;
+}
+
+static void *smpThread(void *arg) {
+    SmpCpu *cpu = arg;
+    SmpMachine *m = cpu->m;
+    unsigned long long logicalMask = (1ULL << m->geo.logicalBits) - 1;
+    double start;
+    size_t k;
+
+    pthread_barrier_wait(&m->start);
+    start = nowNs();
+    for (k = 0; k < cpu->traceLength; k++) {
+        smpAccess(cpu, cpu->trace[k] & logicalMask);
+    }
+    cpu->elapsedNs = nowNs() - start;
+
+    /* keep acking shootdowns until every core is done */
+    atomic_fetch_add(&m->finished, 1);
+    while (atomic_load(&m->finished) < m->cpuCount) {
+        smpWait(cpu);
+    }
+    smpServiceInbox(cpu);
+    return NULL;
+}
+
+/* reads a whole trace into memory so the timed replay does no I/O */
+static unsigned long long *loadTrace(const char *path, size_t *length) {
+    TraceReader trace;
+    unsigned long long *addresses = NULL;
+    size_t capacity = 0;
+    size_t n = 0;
+    size_t got;
+
+    if (openTrace(&trace, path) != 0) {
+        return NULL;
+    }
+    do {
+        if (n + TRACE_BATCH > capacity) {
+            unsigned long long *grown;
+            capacity = capacity == 0 ? TRACE_BATCH : capacity * 2;
+            grown = realloc(addresses, capacity * sizeof(unsigned long long));
+            if (grown == NULL) {
+                fprintf(stderr, "Memory allocation failed.\n");
+                free(addresses);
+                closeTrace(&trace);
+                return NULL;
+            }
+            addresses = grown;
+        }
+        got = readTraceBatch(&trace, addresses + n, TRACE_BATCH);
+        n += got;
+    } while (got > 0);
+    closeTrace(&trace);
+
+    *length = n;
+    return addresses;
+}
+
+static void destroySmp(SmpMachine *m) {
+    int i;
+
+    for (i = 0; i < m->cpuCount; i++) {
+        SmpCpu *cpu = &m->cpus[i];
+        freeTLB(&cpu->tlb);
+        free(cpu->trace);
+        free(cpu->inbox);
+        free(cpu->freeFrames);
+        pthread_mutex_destroy(&cpu->inboxLock);
+        pthread_mutex_destroy(&cpu->freeLock);
+    }
+    if (m->ram != NULL) {
+        munmap(m->ram, (size_t)m->geo.physicalSize);
+    }
+    free(m->pageTable);
+    free(m->framePage);
+    free(m->frameCpus);
+    free(m->frameRef);
+    free(m->frameBusy);
+}
+
+/*
+ * Replays traces[i % traceCount] on core i for cpuCount cores and prints
+ * per-core and total counters with the throughput.
+ * Arguments:
+ *   geo         - const Geometry *
+ *   cpuCount    - int (1 to MAX_THREADS)
+ *   traces      - const char ** (traceCount paths)
+ *   traceCount  - int
+ *   backingData - const signed char *
+ *   backingSize - size_t
+ * Returns:
+ *   int - 0 on success, 1 on error (already reported)
+ */
+static int runSmp(const Geometry *geo, int cpuCount, const char **traces, int traceCount,
+                  const signed char *backingData, size_t backingSize) {
+    SmpMachine *m;
+    pthread_t threads[MAX_THREADS];
+    SmpCpu sum;
+    double start;
+    double elapsed;
+    long long page;
+    int frame;
+    int status = 0;
+    int i;
+
+    m = calloc(1, sizeof(SmpMachine));
+    if (m == NULL) {
+        fprintf(stderr, "Memory allocation failed.\n");
+        return 1;
+    }
+    m->geo = *geo;
+    m->backingData = backingData;
+    m->backingSize = backingSize;
+    m->cpuCount = cpuCount;
+
+    m->ram = mmap(NULL, (size_t)geo->physicalSize, PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (m->ram == MAP_FAILED) {
+        perror("mmap");
+        m->ram = NULL;
+        free(m);
+        return 1;
+    }
+    m->pageTable = malloc((size_t)geo->pageCount * sizeof(atomic_int));
+    m->framePage = malloc((size_t)geo->frameCount * sizeof(atomic_llong));
+    m->frameCpus = malloc((size_t)geo->frameCount * sizeof(atomic_ullong));
+    m->frameRef = malloc((size_t)geo->frameCount * sizeof(atomic_uchar));
+    m->frameBusy = malloc((size_t)geo->frameCount * sizeof(atomic_int));
+    if (m->pageTable == NULL || m->framePage == NULL || m->frameCpus == NULL ||
+        m->frameRef == NULL || m->frameBusy == NULL) {
+        fprintf(stderr, "Memory allocation failed.\n");
+        status = 1;
+    }
+
+    for (page = 0; status == 0 && page < geo->pageCount; page++) {
+        atomic_init(&m->pageTable[page], -1);
+    }
+    /* free frames count as busy so the CLOCK hand leaves them alone */
+    for (frame = 0; status == 0 && frame < geo->frameCount; frame++) {
+        atomic_init(&m->framePage[frame], -1);
+        atomic_init(&m->frameCpus[frame], 0);
+        atomic_init(&m->frameRef[frame], 0);
+        atomic_init(&m->frameBusy[frame], 1);
+    }
+    atomic_init(&m->hand, 0);
+    atomic_init(&m->finished, 0);
+
+    for (i = 0; i < cpuCount; i++) {
+        SmpCpu *cpu = &m->cpus[i];
+        int first = (int)((long long)geo->frameCount * i / cpuCount);
+        int last = (int)((long long)geo->frameCount * (i + 1) / cpuCount);
+
+        cpu->m = m;
+        cpu->id = i;
+        atomic_init(&cpu->inboxPending, 0);
+        atomic_init(&cpu->outstanding, 0);
+        atomic_init(&cpu->freeCount, 0);
+        pthread_mutex_init(&cpu->inboxLock, NULL);
+        pthread_mutex_init(&cpu->freeLock, NULL);
+        if (status != 0) {
+            continue;
+        }
+
+        /* frames are dealt out in contiguous blocks, popped lowest first */
+        cpu->freeFrames = malloc((size_t)(last - first + 1) * sizeof(int));
+        if (cpu->freeFrames == NULL ||
+            initTLB(&cpu->tlb, geo->tlbCount, geo->pageCount, 1) != 0) {
+            fprintf(stderr, "Memory allocation failed.\n");
+            status = 1;
+            continue;
+        }
+        resetTLB(&cpu->tlb);
+        for (frame = last - 1; frame >= first; frame--) {
+            cpu->freeFrames[last - 1 - frame] = frame;
+        }
+        atomic_store_explicit(&cpu->freeCount, last - first, memory_order_relaxed);
+
+        cpu->trace = loadTrace(traces[i % traceCount], &cpu->traceLength);
+        if (cpu->trace == NULL) {
+            status = 1;
+        }
+    }
+
+    if (status != 0) {
+        destroySmp(m);
+        free(m);
+        return status;
+    }
+
+    pthread_barrier_init(&m->start, NULL, (unsigned)cpuCount + 1);
+    for (i = 0; i < cpuCount; i++) {
+        if (pthread_create(&threads[i], NULL, smpThread, &m->cpus[i]) != 0) {
+            fprintf(stderr, "Could not start thread %d.\n", i);
+            exit(1);
+        }
+    }
+    /* the cores cannot start before this thread reaches the barrier */
+    start = nowNs();
+    pthread_barrier_wait(&m->start);
+    for (i = 0; i < cpuCount; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    elapsed = nowNs() - start;
+    pthread_barrier_destroy(&m->start);
+
+    memset(&sum, 0, sizeof(sum));
+    printf("%-4s %15s %12s %12s %12s %12s %12s %14s %10s\n",
+           "Core", "Total addresses", "Page_faults", "TLB Hits", "Fault waits",
+           "Shootdowns", "IPIs recv", "Shootdown ms", "M addr/s");
+    for (i = 0; i < cpuCount; i++) {
+        SmpCpu *cpu = &m->cpus[i];
+        printf("%-4d %15ld %12ld %12ld %12ld %12ld %12ld %14.3f %10.2f\n", i,
+               cpu->total, cpu->faults, cpu->hits, cpu->faultWaits, cpu->shootdowns,
+               cpu->ipisReceived, cpu->shootdownNs / 1e6,
+               cpu->elapsedNs > 0 ? cpu->total * 1e3 / cpu->elapsedNs : 0.0);
+        sum.total += cpu->total;
+        sum.faults += cpu->faults;
+        sum.hits += cpu->hits;
+        sum.faultWaits += cpu->faultWaits;
+        sum.shootdowns += cpu->shootdowns;
+        sum.ipisReceived += cpu->ipisReceived;
+        sum.shootdownNs += cpu->shootdownNs;
+    }
+    printf("%-4s %15ld %12ld %12ld %12ld %12ld %12ld %14.3f %10.2f\n", "all",
+           sum.total, sum.faults, sum.hits, sum.faultWaits, sum.shootdowns,
+           sum.ipisReceived, sum.shootdownNs / 1e6,
+           elapsed > 0 ? sum.total * 1e3 / elapsed : 0.0);
+
+    destroySmp(m);
+    free(m);
+    return 0;
+}
+
+/*
+ * Parses a byte count with an optional K, M or G suffix.
+ * Arguments:
+ *   text - const char *
+ *   out  - unsigned long long * (set on success)
+ * Returns:
+ *   int - 1 on success, 0 if text is not a size
+ */
+static int parseSize(const char *text, unsigned long long *out) {
+    char *end;
+    unsigned long long v = strtoull(text, &end, 10);
+
+    if (end == text) {
+        return 0;
+    }
+    if (*end == 'K' || *end == 'k') {
+        v <<= 10;
+        end++;
+    } else if (*end == 'M' || *end == 'm') {
+        v <<= 20;
+        end++;
+    } else if (*end == 'G' || *end == 'g') {
+        v <<= 30;
+        end++;
+    }
+    if (*end != '\0') {
+        return 0;
+    }
+    *out = v;
+    return 1;
+}
+
+/*
+ * Fills in the derived sizes and checks the limits.
+ * Arguments:
+ *   geo - Geometry * (pageSize, logicalBits, physicalSize, tlbCount and the
+ *         superpage sizes set)
+ * Returns:
+ *   int - 0 if usable, -1 otherwise (already reported)
+ */
+static int finishGeometry(Geometry *geo) {
+    geo->pageBits = 0;
+    while ((1UL << geo->pageBits) < geo->pageSize) {
+        geo->pageBits++;
+    }
+
+    if ((1UL << geo->pageBits) != geo->pageSize ||
+        geo->pageBits < MIN_PAGE_BITS || geo->pageBits > MAX_PAGE_BITS) {
+        fprintf(stderr, "Page size must be a power of two from %d to %d bytes.\n",
+                1 << MIN_PAGE_BITS, 1 << MAX_PAGE_BITS);
+        return -1;
+    }
+    if (geo->logicalBits < geo->pageBits || geo->logicalBits > MAX_LOGICAL_BITS) {
+        fprintf(stderr, "Logical bits must be from log2(page size) to %d.\n", MAX_LOGICAL_BITS);
+        return -1;
+    }
+    if (geo->physicalSize < geo->pageSize || geo->physicalSize % geo->pageSize != 0 ||
+        geo->physicalSize > MAX_PHYSICAL_SIZE) {
+        fprintf(stderr, "Physical size must be a multiple of the page size, at most 4G.\n");
+        return -1;
+    }
+    if (geo->tlbCount < 1 || geo->tlbCount > MAX_TLB_COUNT) {
+        fprintf(stderr, "TLB size must be from 1 to %d.\n", MAX_TLB_COUNT);
+        return -1;
+    }
+
+    geo->pageCount = 1LL << (geo->logicalBits - geo->pageBits);
+    geo->frameCount = (int)(geo->physicalSize / geo->pageSize);
+
+    if (geo->superpagePages != 0 &&
+        (geo->superpagePages < 2 || geo->superpagePages > MAX_SUPERPAGE_PAGES ||
+         (geo->superpagePages & (geo->superpagePages - 1)) != 0 ||
+         geo->superpagePages > geo->frameCount || geo->superpagePages > geo->pageCount)) {
+        fprintf(stderr, "Superpages must be a power of two from 2 to %d pages, "
+                        "at most the frame and page counts.\n", MAX_SUPERPAGE_PAGES);
+        return -1;
+    }
+    if (geo->superpageTlbCount == 0) {
+        geo->superpageTlbCount = SUPERPAGE_TLB_COUNT;
+    }
+    if (geo->superpageTlbCount < 1 || geo->superpageTlbCount > MAX_TLB_COUNT) {
+        fprintf(stderr, "Superpage TLB size must be from 1 to %d.\n", MAX_TLB_COUNT);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Batch replay (--batch): many (policy, frames, TLB size) configurations
+ * of one trace. The trace is decoded once into a buffer all workers read,
+ * and each configuration runs on its own Vmm. Every worker starts with an
+ * equal slice of the configurations and, once its own is used up, steals
+ * from the far end of another worker's slice, so a few slow runs (OPT,
+ * large memories) do not leave the other cores idle.
+ */
+typedef struct {
+    int policy;
+    Geometry geo;
+    SimStats stats;
+    int status;
+} BatchRun;
+
+typedef struct {
+    pthread_mutex_t lock;
+    int head;                        /* next run the owner takes */
+    int tail;                        /* one past the last; thieves take tail - 1 */
+} RunQueue;
+
+typedef struct {
+    BatchRun *runs;
+    RunQueue *queues;
+    int workerCount;
+    const unsigned long long *trace;
+    size_t traceLength;
+    const PageTableKind *kind;
+    const Prefetcher *prefetcher;    /* NULL without --prefetch */
+    int prefetchDegree;
+    int backingFd;
+    const signed char *backingData;
+    size_t backingSize;
+    int zeroCopy;
+} Batch;
+
+typedef struct {
+    Batch *batch;
+    int id;
+    long steals;
+} BatchWorker;
+
+/*
+ * Reads a whole trace into memory.
+ * Arguments:
+ *   path  - const char *
+ *   count - size_t * (filled in)
+ * Returns:
+ *   unsigned long long * - the addresses (writes carry TRACE_WRITE_BIT),
+ *                          NULL on error (already reported)
+ */
+static unsigned long long *decodeTrace(const char *path, size_t *count) {
+    TraceReader trace;
+    unsigned long long *addresses = NULL;
+    size_t capacity = 0;
+    size_t n = 0;
+    size_t got;
+
+    if (openTrace(&trace, path) != 0) {
+        return NULL;
+    }
+    do {
+        if (n + TRACE_BATCH > capacity) {
+            unsigned long long *grown;
+            capacity = capacity == 0 ? (size_t)1 << 20 : capacity * 2;
+            grown = realloc(addresses, capacity * sizeof(unsigned long long));
+            if (grown == NULL) {
+                fprintf(stderr, "Memory allocation failed.\n");
+                free(addresses);
+                closeTrace(&trace);
+                return NULL;
+            }
+            addresses = grown;
+        }
+        got = readTraceBatch(&trace, addresses + n, TRACE_BATCH);
+        n += got;
+    } while (got > 0);
+    closeTrace(&trace);
+
+    *count = n;
+    return addresses;
+}
+
+/* the next run for worker id: its own first, then one stolen, -1 when all are taken */
+static int takeRun(Batch *b, BatchWorker *w) {
+    RunQueue *q = &b->queues[w->id];
+    int run = -1;
+    int i;
+
+    pthread_mutex_lock(&q->lock);
+    if (q->head < q->tail) {
+        run = q->head++;
+    }
+    pthread_mutex_unlock(&q->lock);
+
+    for (i = 1; run < 0 && i < b->workerCount; i++) {
+        q = &b->queues[(w->id + i) % b->workerCount];
+        pthread_mutex_lock(&q->lock);
+        if (q->head < q->tail) {
+            run = --q->tail;
+            w->steals++;
+        }
+        pthread_mutex_unlock(&q->lock);
+    }
+    return run;
+}
+
+static void *batchWorker(void *arg) {
+    BatchWorker *w = arg;
+    Batch *b = w->batch;
+    int r;
+
+    while ((r = takeRun(b, w)) >= 0) {
+        BatchRun *run = &b->runs[r];
+        Vmm vmm;
+
+        if (createVmm(&vmm, &run->geo, b->kind, 1, b->backingFd, b->backingData,
+                      b->backingSize, b->zeroCopy) != 0) {
+            run->status = 1;
+            continue;
+        }
+        if ((b->prefetcher != NULL && initPrefetch(&vmm, b->prefetcher, b->prefetchDegree) != 0) ||
+            resetVmm(&vmm, &policies[run->policy]) != 0) {
+            run->status = 1;
+        } else {
+            memset(&run->stats, 0, sizeof(run->stats));
+            replayBatch(&vmm, b->trace, b->traceLength, OUTPUT_STATS, &run->stats);
+            finishRun(&vmm, &run->stats);
+        }
+        destroyVmm(&vmm);
+    }
+    return NULL;
+}
+
+/*
+ * Reads the configurations: one "POLICY FRAMES TLB_SIZE" per line (POLICY
+ * may be "all"); blank lines and lines starting with # are skipped.
+ * Arguments:
+ *   path           - const char *
+ *   geo            - const Geometry * (everything else comes from here)
+ *   prefetchDegree - int (0 without --prefetch; with it OPT is left out of
+ *                    "all" and rejected, and frames must exceed the degree)
+ *   runs           - BatchRun ** (filled in, to be freed)
+ *   count          - int * (filled in)
+ * Returns:
+ *   int - 0 on success, -1 on error (already reported)
+ */
+static int readBatch(const char *path, const Geometry *geo, int prefetchDegree, BatchRun **runs,
+                     int *count) {
+    FILE *in = fopen(path, "r");
+    int noOpt = prefetchDegree > 0;
+    char line[256];
+    int capacity = 0;
+    int lineNumber = 0;
+
+    *runs = NULL;
+    *count = 0;
+    if (in == NULL) {
+        perror(path);
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), in) != NULL) {
+        char name[16];
+        char *first = line + strspn(line, " \t");
+        long long frames;
+        int tlb;
+        int policy;
+        Geometry runGeo = *geo;
+
+        lineNumber++;
+        if (*first == '#' || *first == '\n' || *first == '\0') {
+            continue;
+        }
+        if (sscanf(first, "%15s %lld %d", name, &frames, &tlb) != 3 || frames < 1) {
+            fprintf(stderr, "%s:%d: expected POLICY FRAMES TLB_SIZE\n", path, lineNumber);
+            fclose(in);
+            return -1;
+        }
+        runGeo.physicalSize = (unsigned long long)frames << geo->pageBits;
+        runGeo.tlbCount = tlb;
+        if (finishGeometry(&runGeo) != 0 || (noOpt && prefetchDegree >= runGeo.frameCount)) {
+            fprintf(stderr, "%s:%d: bad configuration\n", path, lineNumber);
+            fclose(in);
+            return -1;
+        }
+
+        policy = strcmp(name, "all") == 0 ? -1 : findPolicy(name);
+        if (policy < 0 && strcmp(name, "all") != 0) {
+            fprintf(stderr, "%s:%d: unknown policy %s\n", path, lineNumber, name);
+            fclose(in);
+            return -1;
+        }
+        if (noOpt && policy >= 0 && strcmp(policies[policy].name, "OPT") == 0) {
+            fprintf(stderr, "%s:%d: OPT cannot be combined with --prefetch\n", path, lineNumber);
+            fclose(in);
+            return -1;
+        }
+
+        for (policy = policy < 0 ? 0 : policy; policy < POLICY_COUNT; policy++) {
+            if (noOpt && strcmp(policies[policy].name, "OPT") == 0) {
+                continue;
+            }
+            if (*count == capacity) {
+                BatchRun *grown;
+                capacity = capacity > 0 ? capacity * 2 : 64;
+                grown = realloc(*runs, (size_t)capacity * sizeof(BatchRun));
+                if (grown == NULL) {
+                    fprintf(stderr, "Memory allocation failed.\n");
+                    fclose(in);
+                    return -1;
+                }
+                *runs = grown;
+            }
+            memset(&(*runs)[*count], 0, sizeof(BatchRun));
+            (*runs)[*count].policy = policy;
+            (*runs)[*count].geo = runGeo;
+            (*count)++;
+            if (strcmp(name, "all") != 0) {
+                break;
+            }
+        }
+    }
+    fclose(in);
+
+    if (*count == 0) {
+        fprintf(stderr, "%s: no configurations\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Arguments:
+ *   batchPath  - const char * (configuration list)
+ *   tracePath  - const char *
+ *   geo        - const Geometry * (page size, logical bits, superpages)
+ *   b          - Batch * (page table kind, prefetcher, backing store and
+ *                zeroCopy set; the rest filled in here)
+ *   jobs       - int (worker threads, at most MAX_THREADS)
+ * Returns:
+ *   int - 0 on success, 1 on error
+ */
+static int runBatch(const char *batchPath, const char *tracePath, const Geometry *geo, Batch *b,
+                    int jobs) {
+    pthread_t threads[MAX_THREADS];
+    int started[MAX_THREADS];
+    BatchWorker workers[MAX_THREADS];
+    RunQueue queues[MAX_THREADS];
+    BatchRun *runs;
+    unsigned long long *trace;
+    int count;
+    int hasWrites = 0;
+    int needOpt = 0;
+    int status = 0;
+    long steals = 0;
+    double start;
+    size_t k;
+    int i;
+
+    if (readBatch(batchPath, geo, b->prefetcher != NULL ? b->prefetchDegree : 0, &runs, &count) != 0) {
+        free(runs);
+        return 1;
+    }
+    for (i = 0; i < count; i++) {
+        needOpt |= strcmp(policies[runs[i].policy].name, "OPT") == 0;
+    }
+    if (needOpt && buildNextUse(tracePath, geo) != 0) {
+        free(runs);
+        return 1;
+    }
+
+    start = nowNs();
+    trace = decodeTrace(tracePath, &b->traceLength);
+    if (trace == NULL) {
+        free(runs);
+        return 1;
+    }
+    for (k = 0; k < b->traceLength && !hasWrites; k++) {
+        hasWrites = (trace[k] & TRACE_WRITE_BIT) != 0;
+    }
+
+    b->runs = runs;
+    b->trace = trace;
+    b->queues = queues;
+    b->workerCount = jobs < count ? jobs : count;
+    for (i = 0; i < b->workerCount; i++) {
+        pthread_mutex_init(&queues[i].lock, NULL);
+        queues[i].head = (int)((long long)count * i / b->workerCount);
+        queues[i].tail = (int)((long long)count * (i + 1) / b->workerCount);
+        workers[i].batch = b;
+        workers[i].id = i;
+        workers[i].steals = 0;
+    }
+    for (i = 1; i < b->workerCount; i++) {
+        started[i] = pthread_create(&threads[i], NULL, batchWorker, &workers[i]) == 0;
+        if (!started[i]) {
+            fprintf(stderr, "Cannot start worker %d; the others take its runs.\n", i);
+        }
+    }
+    /* the calling thread is worker 0 */
+    batchWorker(&workers[0]);
+    for (i = 1; i < b->workerCount; i++) {
+        if (started[i]) {
+            pthread_join(threads[i], NULL);
+        }
+    }
+    for (i = 0; i < b->workerCount; i++) {
+        pthread_mutex_destroy(&queues[i].lock);
+        steals += workers[i].steals;
+    }
+
+    printf("%-8s %10s %6s %15s %15s %15s %12s", "Policy", "Frames", "TLB", "Total addresses",
+           "Page_faults", "TLB Hits", "Fault rate");
+    printf(hasWrites ? " %15s\n" : "\n", "Write-backs");
+    for (i = 0; i < count; i++) {
+        const SimStats *st = &runs[i].stats;
+
+        if (runs[i].status != 0) {
+            printf("%-8s %10d %6d %15s\n", policies[runs[i].policy].name, runs[i].geo.frameCount,
+                   runs[i].geo.tlbCount, "failed");
+            status = 1;
+            continue;
+        }
+        printf("%-8s %10d %6d %15ld %15ld %15ld %11.2f%%", policies[runs[i].policy].name,
+               runs[i].geo.frameCount, runs[i].geo.tlbCount, st->total, st->faults, st->hits,
+               st->total > 0 ? 100.0 * st->faults / st->total : 0.0);
+        if (hasWrites) {
+            printf(" %15ld", st->writeBacks);
+        }
+        printf("\n");
+    }
+    fprintf(stderr, "%d configurations of %zu addresses on %d threads (%ld stolen) in %.3f s\n",
+            count, b->traceLength, b->workerCount, steals, (nowNs() - start) / 1e9);
+
+    free(trace);
+    free(runs);
+    return status;
+}
+
+int main(int argc, char *argv[]) {
+    const char *tracePath = "addresses.txt";
+    const char *traces[MAX_THREADS];
+    int traceCount = 0;
+    int threadCount = 0;
+    int processes = 0;
+    long quantum = 100;
+    int flushOnSwitch = 0;
+    int allocator = ALLOC_GLOBAL;
+    long wsWindow = WS_WINDOW;
+    long pffInterval = PFF_INTERVAL;
+    long window = ALLOC_WINDOW;
+    const char *timelinePath = NULL;
+    FILE *timeline = NULL;
+    int policyGiven = 0;
+    const char *statsPath = NULL;
+    int statsJson = -1;
+    long statsWindow = ALLOC_WINDOW;
+#if INSTRUMENT
+    Instrument ins;
+#endif
+    Checkpoint ck = { NULL, CHECKPOINT_EVERY, 0, 0, 0, { 0 }, 0 };
+    int resume = 0;
+    double resumeStart;
+    SimStats *perProcess = NULL;
+    const char *backingPath = "BACKING_STORE.bin";
+    Geometry geo = { PAGE_BITS, LOGICAL_BITS, PAGE_SIZE, PHYSICAL_SIZE,
+                     PAGE_COUNT, FRAME_COUNT, TLB_COUNT, 0, 0 };
+    int outputMode = OUTPUT_FULL;
+    int pageTableIndex = -1;
+    int framesMode = -1;
+    int prefetchIndex = -1;
+    int prefetchDegree = PREFETCH_DEGREE;
+    int policyIndex = 0;
+    int allPolicies = 0;
+    int stackDistance = 0;
+    TraceSpec spec = { 0, BENCH_COUNT, 1, 0, 0, PHASE_LENGTH };
+    const char *generatePath = NULL;
+    const char *convertIn = NULL;
+    const char *convertOut = NULL;
+    int convertWidth = 0;
+    int hasStores;
+    const char *goldenPath = NULL;
+    int bench = 0;
+    const char *batchPath = NULL;
+    Batch batch;
+    int jobs = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    FILE *statsOut;
+    int backingFile;
+    struct stat st;
+    signed char *backingData = NULL;
+    size_t backingSize;
+    Vmm vmm;
+    SimStats stats;
+    unsigned long long size;
+    int status = 0;
+    int i;
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            tracePath = argv[++i];
+            if (traceCount < MAX_THREADS) {
+                traces[traceCount++] = tracePath;
+            }
+        } else if (strcmp(argv[i], "--backing") == 0 && i + 1 < argc) {
+            backingPath = argv[++i];
+        } else if (strcmp(argv[i], "--convert") == 0 && i + 2 < argc) {
+            int width = 0;
+            if (i + 4 < argc && strcmp(argv[i + 3], "--width") == 0) {
+                width = atoi(argv[i + 4]);
+                if (width != 2 && width != 4 && width != 8) {
+                    fprintf(stderr, "Width must be 2, 4 or 8.\n");
+                    return 1;
+                }
+            }
+            convertIn = argv[i + 1];
+            convertOut = argv[i + 2];
+            convertWidth = width;
+            i += width != 0 ? 4 : 2;
+        } else if (strcmp(argv[i], "--generate") == 0 && i + 3 < argc) {
+            for (spec.dist = 0; spec.dist < DISTRIBUTION_COUNT; spec.dist++) {
+                if (strcmp(argv[i + 1], distributions[spec.dist].name) == 0) {
+                    break;
+                }
+            }
+            if (spec.dist == DISTRIBUTION_COUNT) {
+                fprintf(stderr, "Unknown distribution: %s\n", argv[i + 1]);
+                return 1;
+            }
+            if (!parseSize(argv[i + 2], &spec.count) || spec.count == 0) {
+                fprintf(stderr, "Bad access count: %s\n", argv[i + 2]);
+                return 1;
+            }
+            generatePath = argv[i + 3];
+            i += 3;
+        } else if ((strcmp(argv[i], "--seed") == 0 || strcmp(argv[i], "--stride") == 0 ||
+                    strcmp(argv[i], "--phase-length") == 0 || strcmp(argv[i], "--bench-count") == 0) &&
+                   i + 1 < argc) {
+            if (!parseSize(argv[i + 1], &size) || (size == 0 && strcmp(argv[i], "--seed") != 0)) {
+                fprintf(stderr, "Bad value for %s: %s\n", argv[i], argv[i + 1]);
+                return 1;
+            }
+            if (strcmp(argv[i], "--seed") == 0) {
+                spec.seed = size;
+            } else if (strcmp(argv[i], "--stride") == 0) {
+                spec.stride = size;
+            } else if (strcmp(argv[i], "--phase-length") == 0) {
+                spec.phaseLength = size;
+            } else {
+                spec.count = size;
+            }
+            i++;
+        } else if (strcmp(argv[i], "--working-set") == 0 && i + 1 < argc) {
+            spec.workingSet = atoll(argv[++i]);
+            if (spec.workingSet <= 0) {
+                fprintf(stderr, "The working set must be at least one page.\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--bench") == 0) {
+            bench = 1;
+        } else if (strcmp(argv[i], "--golden") == 0 && i + 1 < argc) {
+            goldenPath = argv[++i];
+        } else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+            batchPath = argv[++i];
+        } else if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) {
+            jobs = atoi(argv[++i]);
+            if (jobs < 1 || jobs > MAX_THREADS) {
+                fprintf(stderr, "Jobs must be from 1 to %d.\n", MAX_THREADS);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--page-size") == 0 && i + 1 < argc) {
+            if (!parseSize(argv[++i], &size)) {
+                fprintf(stderr, "Bad page size: %s\n", argv[i]);
+                return 1;
+            }
+            geo.pageSize = (unsigned long)size;
+        } else if (strcmp(argv[i], "--logical-bits") == 0 && i + 1 < argc) {
+            geo.logicalBits = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--physical-size") == 0 && i + 1 < argc) {
+            if (!parseSize(argv[++i], &geo.physicalSize)) {
+                fprintf(stderr, "Bad physical size: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--tlb-size") == 0 && i + 1 < argc) {
+            geo.tlbCount = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--superpage") == 0 && i + 1 < argc) {
+            geo.superpagePages = atoi(argv[++i]);
+            if (geo.superpagePages == 0) {
+                geo.superpagePages = -1;
+            }
+        } else if (strcmp(argv[i], "--superpage-tlb") == 0 && i + 1 < argc) {
+            geo.superpageTlbCount = atoi(argv[++i]);
+            if (geo.superpageTlbCount == 0) {
+                geo.superpageTlbCount = -1;
+            }
+        } else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "full") == 0) {
+                outputMode = OUTPUT_FULL;
+            } else if (strcmp(argv[i], "stats") == 0) {
+                outputMode = OUTPUT_STATS;
+            } else if (strcmp(argv[i], "binary") == 0) {
+                outputMode = OUTPUT_BINARY;
+            } else {
+                fprintf(stderr, "Unknown output mode: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--policy") == 0 && i + 1 < argc) {
+            i++;
+            policyGiven = 1;
+            if (strcmp(argv[i], "all") == 0) {
+                allPolicies = 1;
+            } else {
+                policyIndex = findPolicy(argv[i]);
+                if (policyIndex < 0) {
+                    fprintf(stderr, "Unknown policy: %s\n", argv[i]);
+                    return 1;
+                }
+            }
+        } else if (strcmp(argv[i], "--page-table") == 0 && i + 1 < argc) {
+            i++;
+            pageTableIndex = findPageTableKind(argv[i]);
+            if (pageTableIndex < 0) {
+                fprintf(stderr, "Unknown page table: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "copy") == 0) {
+                framesMode = 0;
+            } else if (strcmp(argv[i], "map") == 0) {
+                framesMode = 1;
+            } else {
+                fprintf(stderr, "Unknown frames mode: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--prefetch") == 0 && i + 1 < argc) {
+            i++;
+            prefetchIndex = findPrefetcher(argv[i]);
+            if (prefetchIndex < 0) {
+                fprintf(stderr, "Unknown prefetcher: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--prefetch-degree") == 0 && i + 1 < argc) {
+            prefetchDegree = atoi(argv[++i]);
+            if (prefetchDegree < 1 || prefetchDegree > MAX_PREFETCH_DEGREE) {
+                fprintf(stderr, "Prefetch degree must be from 1 to %d.\n", MAX_PREFETCH_DEGREE);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            threadCount = atoi(argv[++i]);
+            if (threadCount < 1 || threadCount > MAX_THREADS) {
+                fprintf(stderr, "Threads must be from 1 to %d.\n", MAX_THREADS);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--processes") == 0) {
+            processes = 1;
+        } else if (strcmp(argv[i], "--quantum") == 0 && i + 1 < argc) {
+            quantum = atol(argv[++i]);
+            if (quantum < 1) {
+                fprintf(stderr, "Quantum must be at least 1.\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--tlb-switch") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "asid") == 0) {
+                flushOnSwitch = 0;
+            } else if (strcmp(argv[i], "flush") == 0) {
+                flushOnSwitch = 1;
+            } else {
+                fprintf(stderr, "Unknown TLB switch mode: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--allocator") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "global") == 0) {
+                allocator = ALLOC_GLOBAL;
+            } else if (strcmp(argv[i], "ws") == 0) {
+                allocator = ALLOC_WS;
+            } else if (strcmp(argv[i], "pff") == 0) {
+                allocator = ALLOC_PFF;
+            } else {
+                fprintf(stderr, "Unknown allocator: %s\n", argv[i]);
+                return 1;
+            }
+        } else if ((strcmp(argv[i], "--ws-window") == 0 || strcmp(argv[i], "--pff-interval") == 0 ||
+                    strcmp(argv[i], "--window") == 0) && i + 1 < argc) {
+            long value = atol(argv[i + 1]);
+            if (value < 1) {
+                fprintf(stderr, "%s must be at least 1.\n", argv[i]);
+                return 1;
+            }
+            if (strcmp(argv[i], "--ws-window") == 0) {
+                wsWindow = value;
+            } else if (strcmp(argv[i], "--pff-interval") == 0) {
+                pffInterval = value;
+            } else {
+                window = value;
+            }
+            i++;
+        } else if (strcmp(argv[i], "--stats-out") == 0 && i + 1 < argc) {
+            statsPath = argv[++i];
+        } else if (strcmp(argv[i], "--stats-format") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "csv") == 0) {
+                statsJson = 0;
+            } else if (strcmp(argv[i], "json") == 0) {
+                statsJson = 1;
+            } else {
+                fprintf(stderr, "Unknown stats format: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--stats-window") == 0 && i + 1 < argc) {
+            statsWindow = atol(argv[++i]);
+            if (statsWindow < 1) {
+                fprintf(stderr, "--stats-window must be at least 1.\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--checkpoint") == 0 && i + 1 < argc) {
+            ck.path = argv[++i];
+        } else if (strcmp(argv[i], "--checkpoint-every") == 0 && i + 1 < argc) {
+            ck.every = atol(argv[++i]);
+            if (ck.every < 1) {
+                fprintf(stderr, "--checkpoint-every must be at least 1.\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--resume") == 0) {
+            resume = 1;
+        } else if (strcmp(argv[i], "--timeline") == 0 && i + 1 < argc) {
+            timelinePath = argv[++i];
+        } else if (strcmp(argv[i], "--stack-distance") == 0) {
+            stackDistance = 1;
+        } else if (strcmp(argv[i], "--tlb-probe") == 0 && i + 1 < argc) {
+            i++;
+            if (!selectTLBProbe(argv[i], &tlbProbe)) {
+                fprintf(stderr, "Unknown or unsupported TLB probe: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--tlb-bench") == 0) {
+            return runTLBBench();
+        } else {
+            fprintf(stderr,
+                    "Usage: %s [--trace FILE] [--backing FILE] [--output full|stats|binary]\n"
+                    "          [--policy fifo|lru|clock|lfu|opt|all]\n"
+                    "          [--page-size N] [--logical-bits N] [--physical-size N[K|M|G]]\n"
+                    "          [--tlb-size N] [--tlb-probe index|scalar|sse4|avx2|simd]\n"
+                    "          [--page-table flat|2level|4level|inverted] [--frames copy|map]\n"
+                    "          [--superpage PAGES] [--superpage-tlb N]\n"
+                    "          [--prefetch next|stride|markov] [--prefetch-degree N]\n"
+                    "          [--stats-out FILE] [--stats-format csv|json] [--stats-window N]\n"
+                    "          [--checkpoint FILE] [--checkpoint-every N] [--resume]\n"
+                    "       %s --processes [--trace FILE]... [--quantum N] [--tlb-switch asid|flush]\n"
+                    "          [--policy fifo|lru|clock|lfu|all] [geometry and page table options]\n"
+                    "          [--allocator global|ws|pff] [--ws-window N] [--pff-interval N]\n"
+                    "          [--window N] [--timeline FILE]\n"
+                    "       %s --threads N [--trace FILE]... [--backing FILE] [--page-size N]\n"
+                    "          [--logical-bits N] [--physical-size N[K|M|G]] [--tlb-size N]\n"
+                    "       %s [--trace FILE] [--page-size N] [--logical-bits N] --stack-distance\n"
+                    "       %s --batch FILE [--jobs N] [--trace FILE] [geometry, page table, frames,\n"
+                    "          superpage and prefetch options]\n"
+                    "       %s --tlb-bench\n"
+                    "       %s --bench [--bench-count N] [--golden FILE] [generator, machine and policy options]\n"
+                    "       %s --generate uniform|zipf|seq|stride|loop|phase COUNT BINARY_TRACE\n"
+                    "          [--seed N] [--stride BYTES] [--working-set PAGES] [--phase-length N]\n"
+                    "          [--page-size N] [--logical-bits N] [--physical-size N[K|M|G]]\n"
+                    "       %s --convert TEXT_TRACE BINARY_TRACE [--width 2|4|8] [--logical-bits N]\n",
+                    argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0]);
+            return 1;
+        }
+    }
+
+    if (finishGeometry(&geo) != 0) {
+        return 1;
+    }
+
+    if (stackDistance) {
+        return runStackDistance(tracePath, &geo);
+    }
+    if (generatePath != NULL) {
+        return generateTrace(generatePath, &spec, &geo);
+    }
+    if (convertIn != NULL) {
+        return convertTrace(convertIn, convertOut, convertWidth, &geo);
+    }
+    if (batchPath != NULL && (processes || threadCount > 0 || bench || statsPath != NULL || policyGiven)) {
+        fprintf(stderr, "--batch replays one trace as one process; policies, frames and TLB sizes "
+                        "come from its file.\n");
+        return 1;
+    }
+    if (jobs < 1) {
+        jobs = 1;
+    } else if (jobs > MAX_THREADS) {
+        jobs = MAX_THREADS;
+    }
+    if (bench && (processes || threadCount > 0 || allPolicies || statsPath != NULL ||
+                  strcmp(policies[policyIndex].name, "OPT") == 0)) {
+        fprintf(stderr, "--bench runs one policy other than OPT on a single process and core.\n");
+        return 1;
+    }
+
+    if (pageTableIndex == 0 && geo.pageCount > FLAT_TABLE_MAX_PAGES) {
+        fprintf(stderr, "A flat page table for 2^%d pages is too big; use 2level, 4level or inverted.\n",
+                geo.logicalBits - geo.pageBits);
+        return 1;
+    }
+    if (threadCount > 0 && (geo.pageCount > FLAT_TABLE_MAX_PAGES || geo.frameCount <= threadCount)) {
+        fprintf(stderr, "--threads needs at most 2^26 pages and more frames than threads.\n");
+        return 1;
+    }
+    if (geo.superpagePages > 0 && (threadCount > 0 || processes)) {
+        fprintf(stderr, "--superpage works on a single process and core.\n");
+        return 1;
+    }
+    if (prefetchIndex >= 0 && (threadCount > 0 || processes)) {
+        fprintf(stderr, "--prefetch works on a single process and core.\n");
+        return 1;
+    }
+    /* OPT's next use is known for demand loads only */
+    if (prefetchIndex >= 0 && !allPolicies && strcmp(policies[policyIndex].name, "OPT") == 0) {
+        fprintf(stderr, "OPT cannot be combined with --prefetch.\n");
+        return 1;
+    }
+    if (prefetchIndex >= 0 && prefetchDegree >= geo.frameCount) {
+        fprintf(stderr, "The prefetch degree must be below the frame count.\n");
+        return 1;
+    }
+    if (traceCount == 0) {
+        traces[traceCount++] = tracePath;
+    }
+#if INSTRUMENT
+    if (statsPath != NULL && (processes || threadCount > 0 || allPolicies || stackDistance)) {
+        fprintf(stderr, "--stats-out works on a single run of one policy.\n");
+        return 1;
+    }
+    /* the format follows the file name unless given */
+    if (statsJson == -1) {
+        statsJson = statsPath != NULL && strlen(statsPath) >= 5 &&
+                    strcmp(statsPath + strlen(statsPath) - 5, ".json") == 0;
+    }
+#else
+    if (statsPath != NULL) {
+        fprintf(stderr, "Built with INSTRUMENT=0; --stats-out is not available.\n");
+        return 1;
+    }
+    (void)statsJson;
+    (void)statsWindow;
+#endif
+    if (resume && ck.path == NULL) {
+        fprintf(stderr, "--resume needs --checkpoint FILE.\n");
+        return 1;
+    }
+    if (ck.path != NULL && (processes || threadCount > 0 || allPolicies || batchPath != NULL || bench ||
+                            statsPath != NULL || geo.superpagePages > 0 || prefetchIndex >= 0)) {
+        fprintf(stderr, "--checkpoint works on a single run of one policy without superpages, "
+                        "prefetching or --stats-out.\n");
+        return 1;
+    }
+    if (ck.path != NULL) {
+        /* a snapshot only fits the trace it was taken from */
+        if (stat(tracePath, &st) != 0) {
+            perror(tracePath);
+            return 1;
+        }
+        ck.traceSize = (long long)st.st_size;
+    }
+    if ((allocator != ALLOC_GLOBAL || timelinePath != NULL) && !processes) {
+        fprintf(stderr, "--allocator and --timeline need --processes.\n");
+        return 1;
+    }
+    if (allocator != ALLOC_GLOBAL && policyGiven) {
+        fprintf(stderr, "The ws and pff allocators replace LRU within each process; drop --policy.\n");
+        return 1;
+    }
+    if (processes && !allPolicies && strcmp(policies[policyIndex].name, "OPT") == 0) {
+        fprintf(stderr, "OPT needs a single trace; it is not available with --processes.\n");
+        return 1;
+    }
+    if (tlbProbe != NULL && geo.pageCount * (processes ? traceCount : 1) > (1LL << 31)) {
+        fprintf(stderr, "TLB probes need page numbers below 2^31; use --tlb-probe index.\n");
+        return 1;
+    }
+
+    /* Step 1: open input files and initialize tables */
+    /* writable only if dirty pages may be written back; generated traces have no stores */
+    hasStores = 0;
+    for (i = 0; !bench && i < (traceCount > 0 ? traceCount : 1) && hasStores == 0; i++) {
+        hasStores = traceHasStores(traceCount > 0 ? traces[i] : tracePath);
+    }
+    if (hasStores < 0) {
+        return 1;
+    }
+    backingFile = open(backingPath, hasStores ? O_RDWR : O_RDONLY);
+    if (backingFile < 0 && hasStores) {
+        backingFile = open(backingPath, O_RDONLY);
+    }
+    if (backingFile < 0) {
+        perror(backingPath);
+        return 1;
+    }
+
+    if (fstat(backingFile, &st) != 0) {
+        perror(backingPath);
+        close(backingFile);
+        return 1;
+    }
+
+    /* only the part of the logical space the file covers is mapped */
+    backingSize = (size_t)st.st_size;
+    if (backingSize > (1ULL << geo.logicalBits)) {
+        backingSize = (size_t)(1ULL << geo.logicalBits);
+    }
+    if (backingSize > 0) {
+        backingData = mmap(NULL, backingSize, PROT_READ, MAP_PRIVATE, backingFile, 0);
+        if (backingData == MAP_FAILED) {
+            perror("mmap");
+            close(backingFile);
+            return 1;
+        }
+        /* mapped frames are read in place, so start paging the file in now */
+        if (framesMode == 1) {
+            madvise(backingData, backingSize, MADV_WILLNEED);
+        }
+    }
+
+    if (batchPath != NULL) {
+        memset(&batch, 0, sizeof(batch));
+        batch.kind = &pageTableKinds[pageTableIndex >= 0 ? pageTableIndex
+                                     : geo.pageCount <= FLAT_TABLE_MAX_PAGES ? 0 : 2];
+        batch.prefetcher = prefetchIndex >= 0 ? &prefetchers[prefetchIndex] : NULL;
+        batch.prefetchDegree = prefetchDegree;
+        batch.backingFd = backingFile;
+        batch.backingData = backingData;
+        batch.backingSize = backingSize;
+        batch.zeroCopy = framesMode == 1;
+        status = runBatch(batchPath, traces[0], &geo, &batch, jobs);
+    } else if (threadCount > 0) {
+        status = runSmp(&geo, threadCount, traces, traceCount, backingData, backingSize);
+    /* keep the original flat table when it fits, otherwise walk 4 levels */
+    } else if (createVmm(&vmm, &geo,
+                  &pageTableKinds[pageTableIndex >= 0 ? pageTableIndex
+                                  : geo.pageCount <= FLAT_TABLE_MAX_PAGES ? 0 : 2],
+                  processes ? traceCount : 1,
+                  backingFile, backingData, backingSize, framesMode == 1) != 0) {
+        status = 1;
+    } else if (prefetchIndex >= 0 &&
+               initPrefetch(&vmm, &prefetchers[prefetchIndex], prefetchDegree) != 0) {
+        status = 1;
+        destroyVmm(&vmm);
+    } else if (processes) {
+        /* Step 2 interleaved: one process per trace, round robin on a quantum */
+        perProcess = malloc((size_t)traceCount * sizeof(SimStats));
+        if (timelinePath != NULL) {
+            timeline = fopen(timelinePath, "w");
+            if (timeline == NULL) {
+                perror(timelinePath);
+            }
+        }
+        if (perProcess == NULL) {
+            fprintf(stderr, "Memory allocation failed.\n");
+            status = 1;
+        } else if (timelinePath != NULL && timeline == NULL) {
+            status = 1;
+        } else if (allPolicies) {
+            if (compareSwitchModes(&vmm, traces, quantum) != 0) {
+                status = 1;
+            }
+        } else if ((allocator != ALLOC_GLOBAL &&
+                    initAllocator(&vmm, allocator,
+                                  allocator == ALLOC_WS ? wsWindow : pffInterval) != 0) ||
+                   resetVmm(&vmm, &policies[policyIndex]) != 0 ||
+                   runProcesses(&vmm, traces, quantum, flushOnSwitch,
+                                allocator != ALLOC_GLOBAL || timeline != NULL ? window : 0,
+                                timeline, &stats, perProcess) != 0) {
+            status = 1;
+        } else {
+            printf("%-8s %15s %15s %15s\n", "Process", "Total addresses", "Page_faults", "TLB Hits");
+            for (i = 0; i < traceCount; i++) {
+                printf("%-8d %15ld %15ld %15ld\n", i,
+                       perProcess[i].total, perProcess[i].faults, perProcess[i].hits);
+            }
+            printf("Total addresses = %ld\n", stats.total);
+            printf("Page_faults = %ld\n", stats.faults);
+            printf("TLB Hits = %ld\n", stats.hits);
+            printf("TLB misses = %ld\n", stats.total - stats.hits);
+            printf("Context switches = %ld\n", stats.contextSwitches);
+            if (stats.writes > 0) {
+                printf("Writes = %ld\n", stats.writes);
+                printf("Write-backs = %ld\n", stats.writeBacks);
+            }
+            if (allocator != ALLOC_GLOBAL) {
+                printf("Released pages = %ld\n", stats.releases);
+            }
+            if (stats.windows > 0) {
+                printf("Thrashing windows = %ld of %ld\n", stats.thrashingWindows, stats.windows);
+            }
+        }
+        if (timeline != NULL && fclose(timeline) != 0) {
+            perror(timelinePath);
+            status = 1;
+        }
+        free(perProcess);
+        destroyVmm(&vmm);
+    } else {
+        if (bench) {
+            status = runBench(&vmm, &policies[policyIndex], &spec, goldenPath);
+        } else if ((allPolicies || strcmp(policies[policyIndex].name, "OPT") == 0) &&
+                   buildNextUse(tracePath, &geo) != 0) {
+            status = 1;
+        } else if (allPolicies) {
+            /* one stats-only run per policy, compared side by side */
+            int hasWrites = 0;
+            for (i = 0; i < POLICY_COUNT; i++) {
+                if (prefetchIndex >= 0 && strcmp(policies[i].name, "OPT") == 0) {
+                    continue;
+                }
+                if (resetVmm(&vmm, &policies[i]) != 0 ||
+                    runTrace(&vmm, tracePath, OUTPUT_STATS, &stats) != 0) {
+                    status = 1;
+                    break;
+                }
+                /* the write-back column only appears for traces with writes */
+                if (i == 0) {
+                    hasWrites = stats.writes > 0;
+                    printf("%-8s %15s %15s %15s %12s", "Policy", "Total addresses",
+                           "Page_faults", "TLB Hits", "Fault rate");
+                    printf(hasWrites ? " %15s" : "", "Write-backs");
+                    if (geo.superpagePages > 0) {
+                        printf(" %15s %12s", "Superpage hits", "Promotions");
+                    }
+                    if (prefetchIndex >= 0) {
+                        printf(" %12s %12s %12s", "Prefetches", "Useful", "Wasted");
+                    }
+                    printf("\n");
+                }
+                printf("%-8s %15ld %15ld %15ld %11.2f%%", policies[i].name,
+                       stats.total, stats.faults, stats.hits,
+                       stats.total > 0 ? 100.0 * stats.faults / stats.total : 0.0);
+                if (hasWrites) {
+                    printf(" %15ld", stats.writeBacks);
+                }
+                if (geo.superpagePages > 0) {
+                    printf(" %15ld %12ld", stats.superpageHits, stats.promotions);
+                }
+                if (prefetchIndex >= 0) {
+                    printf(" %12ld %12ld %12ld", stats.prefetches, stats.prefetchUseful,
+                           stats.prefetchWasted);
+                }
+                printf("\n");
+            }
+        } else {
+#if INSTRUMENT
+            if (statsPath != NULL) {
+                if (initInstrument(&ins, geo.pageCount, statsWindow) != 0) {
+                    fprintf(stderr, "Memory allocation failed.\n");
+                    status = 1;
+                }
+                vmm.ins = &ins;
+            }
+#endif
+            if (ck.path != NULL) {
+                vmm.ck = &ck;
+            }
+            if (status == 0 && resetVmm(&vmm, &policies[policyIndex]) != 0) {
+                status = 1;
+            }
+            if (status == 0 && resume) {
+                resumeStart = nowNs();
+                resume = readCheckpoint(&vmm);
+                if (resume == 1) {
+                    fprintf(stderr, "Resumed at address %ld from %s (%.1f ms)\n", ck.stats.total,
+                            ck.path, (nowNs() - resumeStart) / 1e6);
+                } else if (resume == 0) {
+                    fprintf(stderr, "No checkpoint in %s yet; starting from the beginning.\n", ck.path);
+                } else {
+                    status = 1;
+                }
+            }
+            if (status != 0 || runTrace(&vmm, tracePath, outputMode, &stats) != 0) {
+                status = 1;
+            } else {
+                /* Step 6: print final statistics and clean up */
+                statsOut = outputMode == OUTPUT_BINARY ? stderr : stdout;
+                fprintf(statsOut, "Total addresses = %ld\n", stats.total);
+                fprintf(statsOut, "Page_faults = %ld\n", stats.faults);
+                fprintf(statsOut, "TLB Hits = %ld\n", stats.hits);
+                if (stats.writes > 0) {
+                    fprintf(statsOut, "Writes = %ld\n", stats.writes);
+                    fprintf(statsOut, "Write-backs = %ld\n", stats.writeBacks);
+                    fprintf(statsOut, "Write-back bytes = %llu\n", stats.writeBackBytes);
+                    fprintf(statsOut, "Write-back calls = %ld\n", stats.writeBackCalls);
+                }
+
+                /* walk costs only when a page table was asked for, so default output is unchanged */
+                if (pageTableIndex >= 0) {
+                    fprintf(statsOut, "Page table = %s\n", vmm.pageTables[0].kind->name);
+                    fprintf(statsOut, "Page walks = %ld\n", stats.total - stats.hits);
+                    fprintf(statsOut, "Page walk memory references = %lld\n", vmm.pageTables[0].refs);
+                    fprintf(statsOut, "Page table bytes = %zu\n", vmm.pageTables[0].bytes);
+                }
+                if (framesMode >= 0) {
+                    fprintf(statsOut, "Bytes copied = %llu\n", stats.bytesCopied);
+                }
+                if (geo.superpagePages > 0) {
+                    fprintf(statsOut, "Superpage TLB hits = %ld\n", stats.superpageHits);
+                    fprintf(statsOut, "Promotions = %ld\n", stats.promotions);
+                    fprintf(statsOut, "Demotions = %ld\n", stats.demotions);
+                    /* reach: memory the TLBs map at once */
+                    fprintf(statsOut, "TLB reach = %llu bytes (%llu without superpages)\n",
+                            (unsigned long long)(geo.tlbCount +
+                                                 geo.superpageTlbCount * geo.superpagePages) *
+                                geo.pageSize,
+                            (unsigned long long)geo.tlbCount * geo.pageSize);
+                }
+                if (prefetchIndex >= 0) {
+                    fprintf(statsOut, "Prefetches = %ld\n", stats.prefetches);
+                    fprintf(statsOut, "Prefetches useful = %ld\n", stats.prefetchUseful);
+                    fprintf(statsOut, "Prefetches wasted = %ld\n", stats.prefetchWasted);
+                    fprintf(statsOut, "Prefetch copies = %ld\n", stats.prefetchCopies);
+                }
+#if INSTRUMENT
+                if (statsPath != NULL && writeInstrument(&ins, &stats, statsPath, statsJson) != 0) {
+                    status = 1;
+                }
+#endif
+            }
+#if INSTRUMENT
+            if (statsPath != NULL) {
+                freeInstrument(&ins);
+            }
+#endif
+        }
+        destroyVmm(&vmm);
+    }
+
+    free(optNextUse);
+    if (backingData != NULL) {
+        munmap(backingData, backingSize);
+    }
+    close(backingFile);
+
+    return status;
+}
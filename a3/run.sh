@@ -1,3 +1,3 @@
-gcc assignment3.c -o assignment3
+gcc -pthread assignment3.c -o assignment3
 assignment3.exe
 pause
\ No newline at end of file